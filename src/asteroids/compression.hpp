@@ -0,0 +1,370 @@
+#pragma once
+
+#include "logging.hpp"
+
+AE_NAMESPACE_BEGIN
+
+namespace impl {
+	// The codec is LZ77 using LZ4's block layout. Every sequence is:
+	// [token: literal length << 4 | match length - minMatch][literal length bytes...][literals][offset: u16][match length bytes...]
+	// A length nibble of 15 continues in extra bytes, each 255 means "keep reading".
+	// The last sequence of a block only has literals.
+	constexpr size_t lzMinMatch = 4;
+	constexpr size_t lzMaxOffset = 0xFFFF;
+	constexpr u32 lzHashBits = 12;
+
+	inline u32 lzRead32(const u8* p) {
+		u32 value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	inline u32 lzHash(u32 sequence) {
+		return (sequence * 2654435761u) >> (32 - lzHashBits);
+	}
+
+	inline void lzWriteLength(std::vector<u8>& dst, size_t length) {
+		while (length >= 255) {
+			dst.push_back(255);
+			length -= 255;
+		}
+
+		dst.push_back((u8)length);
+	}
+
+	// returns false if the length runs past end
+	inline bool lzReadLength(const u8*& src, const u8* end, size_t& length) {
+		u8 byte;
+		do {
+			if (src >= end)
+				return false;
+
+			byte = *src++;
+			length += byte;
+		} while (byte == 255);
+
+		return true;
+	}
+}
+
+/*
+ * Bytes that are treated as if they came right before every compressed message, so even short
+ * messages can reference byte patterns common to most snapshots (archetype headers, component ids, ...).
+ * Train one offline from recorded messages with train(), ship it with the game and load() it on
+ * both ends; a dictionary is only used when both peers have the exact same one.
+ */
+class CompressionDictionary {
+public:
+	static constexpr size_t maxSize = impl::lzMaxOffset;
+	static constexpr size_t defaultSize = 16 * 1024;
+
+	CompressionDictionary() = default;
+
+	explicit CompressionDictionary(std::vector<u8> newBytes)
+		: bytes(std::move(newBytes)) {
+		if (bytes.size() > maxSize)
+			bytes.erase(bytes.begin(), bytes.end() - maxSize); // the end is the most valuable part
+
+		// FNV-1a, used to check that both peers have the same dictionary
+		hash = 14695981039346656037ull;
+		for (u8 byte : bytes)
+			hash = (hash ^ byte) * 1099511628211ull;
+
+		// hash every position once, so compressing doesn't have to
+		hashTable.assign((size_t)1 << impl::lzHashBits, 0);
+		for (size_t i = 0; i + impl::lzMinMatch <= bytes.size(); i++)
+			hashTable[impl::lzHash(impl::lzRead32(&bytes[i]))] = (u32)i;
+	}
+
+	NODISCARD bool empty() const { return bytes.empty(); }
+	NODISCARD size_t size() const { return bytes.size(); }
+	NODISCARD const std::vector<u8>& getBytes() const { return bytes; }
+	NODISCARD const std::vector<u32>& getHashTable() const { return hashTable; }
+
+	/* Zero for the empty dictionary */
+	NODISCARD u64 getHash() const { return bytes.empty() ? 0 : hash; }
+
+	/*
+	 * Builds a dictionary out of the byte strings that appear in the most samples.
+	 *
+	 * Every sample is cut into overlapping segments, a segment's score is how many samples
+	 * share each of its 8 byte substrings. The best segments are picked greedily, substrings
+	 * already in the dictionary stop counting towards the score of the remaining ones.
+	 */
+	static CompressionDictionary train(const std::vector<std::vector<u8>>& samples, size_t size = defaultSize) {
+		constexpr size_t gramSize = 8;
+		constexpr size_t segmentSize = 32;
+
+		size = std::min(size, maxSize);
+
+		// in how many samples does each substring appear?
+		std::unordered_map<u64, u32> frequency;
+		std::vector<u64> grams;
+		for (const std::vector<u8>& sample : samples) {
+			grams.clear();
+			for (size_t i = 0; i + gramSize <= sample.size(); i++) {
+				u64 gram;
+				memcpy(&gram, &sample[i], gramSize);
+				grams.push_back(gram);
+			}
+
+			std::sort(grams.begin(), grams.end());
+			grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+			for (u64 gram : grams)
+				frequency[gram]++;
+		}
+
+		struct Segment {
+			u64 score;
+			u32 sample;
+			u32 offset;
+
+			bool operator<(const Segment& other) const { return score < other.score; }
+		};
+
+		auto scoreSegment = [&](const Segment& segment) {
+			const std::vector<u8>& sample = samples[segment.sample];
+			const size_t end = std::min(sample.size(), (size_t)segment.offset + segmentSize);
+
+			u64 score = 0;
+			for (size_t i = segment.offset; i + gramSize <= end; i++) {
+				u64 gram;
+				memcpy(&gram, &sample[i], gramSize);
+
+				auto it = frequency.find(gram);
+				if (it != frequency.end() && it->second > 1) // only shared substrings are worth anything
+					score += it->second;
+			}
+
+			return score;
+		};
+
+		std::priority_queue<Segment> queue;
+		for (u32 sampleI = 0; sampleI < samples.size(); sampleI++) {
+			for (size_t offset = 0; offset + gramSize <= samples[sampleI].size(); offset += segmentSize / 2) {
+				Segment segment = { 0, sampleI, (u32)offset };
+				segment.score = scoreSegment(segment);
+				if (segment.score > 0)
+					queue.push(segment);
+			}
+		}
+
+		std::vector<Segment> picked;
+		size_t pickedSize = 0;
+		while (!queue.empty() && pickedSize < size) {
+			Segment segment = queue.top();
+			queue.pop();
+
+			// scores only ever go down, so a rescored segment still on top is the real best
+			segment.score = scoreSegment(segment);
+			if (segment.score == 0)
+				continue;
+			if (!queue.empty() && segment.score < queue.top().score) {
+				queue.push(segment);
+				continue;
+			}
+
+			const std::vector<u8>& sample = samples[segment.sample];
+			const size_t end = std::min(sample.size(), (size_t)segment.offset + segmentSize);
+			for (size_t i = segment.offset; i + gramSize <= end; i++) {
+				u64 gram;
+				memcpy(&gram, &sample[i], gramSize);
+				frequency.erase(gram);
+			}
+
+			picked.push_back(segment);
+			pickedSize += end - segment.offset;
+		}
+
+		// the best segments go last, closest to the data being compressed
+		std::vector<u8> bytes;
+		bytes.reserve(pickedSize);
+		for (auto it = picked.rbegin(); it != picked.rend(); ++it) {
+			const std::vector<u8>& sample = samples[it->sample];
+			const size_t end = std::min(sample.size(), (size_t)it->offset + segmentSize);
+			bytes.insert(bytes.end(), sample.begin() + it->offset, sample.begin() + end);
+		}
+
+		if (bytes.size() > size)
+			bytes.erase(bytes.begin(), bytes.end() - size);
+
+		return CompressionDictionary(std::move(bytes));
+	}
+
+	void save(const std::string& path) const {
+		std::ofstream file(path, std::ios::binary);
+		if (!file.is_open() || file.bad()) {
+			log(ERROR_SEVERITY_FATAL, "Failed to open dictionary file(write): %s\n", path.c_str());
+		}
+
+		file.write((const char*)bytes.data(), (std::streamsize)bytes.size());
+	}
+
+	/* Returns an empty dictionary if the file can't be read */
+	static CompressionDictionary load(const std::string& path) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file.is_open() || file.bad()) {
+			log(ERROR_SEVERITY_WARNING, "Failed to open dictionary file(read): %s\n", path.c_str());
+			return CompressionDictionary();
+		}
+
+		return CompressionDictionary(std::vector<u8>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()));
+	}
+
+private:
+	std::vector<u8> bytes;
+	std::vector<u32> hashTable;
+	u64 hash = 0;
+};
+
+/*
+ * Compresses and decompresses network messages. Keeps its scratch memory between calls,
+ * so use one per thread.
+ */
+class MessageCodec {
+public:
+	/*
+	 * Compresses size bytes of src into dst, which is cleared first.
+	 * Returns false, leaving dst unspecified, if the result would not be smaller than src.
+	 */
+	bool compress(const u8* src, size_t size, std::vector<u8>& dst, const CompressionDictionary* dictionary = nullptr) {
+		using namespace impl;
+
+		dst.clear();
+
+		// the dictionary and src are laid out back to back so matches can reach into the dictionary
+		const size_t dictionarySize = dictionary ? dictionary->size() : 0;
+		window.resize(dictionarySize + size);
+		if (dictionarySize)
+			memcpy(window.data(), dictionary->getBytes().data(), dictionarySize);
+		memcpy(window.data() + dictionarySize, src, size);
+
+		if (dictionarySize)
+			table = dictionary->getHashTable();
+		else
+			table.assign((size_t)1 << lzHashBits, 0);
+
+		const u8* base = window.data();
+		const size_t end = window.size();
+		size_t anchor = dictionarySize;
+		size_t pos = dictionarySize;
+
+		while (pos + lzMinMatch <= end) {
+			const u32 sequence = lzRead32(base + pos);
+			const u32 hash = lzHash(sequence);
+			const size_t candidate = table[hash];
+			table[hash] = (u32)pos;
+
+			if (candidate >= pos || pos - candidate > lzMaxOffset || lzRead32(base + candidate) != sequence) {
+				pos += 1 + ((pos - anchor) >> 6); // skip faster through data that doesn't compress
+				continue;
+			}
+
+			size_t matchLength = lzMinMatch;
+			while (pos + matchLength < end && base[candidate + matchLength] == base[pos + matchLength])
+				matchLength++;
+
+			writeSequence(dst, base + anchor, pos - anchor, pos - candidate, matchLength);
+			if (dst.size() >= size)
+				return false;
+
+			pos += matchLength;
+			anchor = pos;
+		}
+
+		writeSequence(dst, base + anchor, end - anchor, 0, 0);
+		return dst.size() < size;
+	}
+
+	/*
+	 * Decompresses src into dst, which must come out exactly decompressedSize bytes long.
+	 * The data comes from the network, so it is never trusted: returns false if it is malformed.
+	 */
+	bool decompress(const u8* src, size_t size, size_t decompressedSize, std::vector<u8>& dst, const CompressionDictionary* dictionary = nullptr) {
+		using namespace impl;
+
+		const size_t dictionarySize = dictionary ? dictionary->size() : 0;
+		window.resize(dictionarySize + decompressedSize);
+		if (dictionarySize)
+			memcpy(window.data(), dictionary->getBytes().data(), dictionarySize);
+
+		const u8* in = src;
+		const u8* inEnd = src + size;
+		u8* out = window.data() + dictionarySize;
+		u8* const outStart = window.data();
+		u8* const outEnd = window.data() + window.size();
+
+		while (in < inEnd) {
+			const u8 token = *in++;
+
+			size_t literalLength = token >> 4;
+			if (literalLength == 15 && !lzReadLength(in, inEnd, literalLength))
+				return false;
+			if (literalLength > (size_t)(inEnd - in) || literalLength > (size_t)(outEnd - out))
+				return false;
+
+			memcpy(out, in, literalLength);
+			in += literalLength;
+			out += literalLength;
+
+			if (in == inEnd)
+				break; // the last sequence has no match
+
+			if (inEnd - in < 2)
+				return false;
+
+			const size_t offset = (size_t)in[0] | ((size_t)in[1] << 8);
+			in += 2;
+
+			size_t matchLength = token & 15;
+			if (matchLength == 15 && !lzReadLength(in, inEnd, matchLength))
+				return false;
+			matchLength += lzMinMatch;
+
+			if (offset == 0 || offset > (size_t)(out - outStart) || matchLength > (size_t)(outEnd - out))
+				return false;
+
+			// matches closer than their length overlap what they produce, those go byte by byte
+			const u8* match = out - offset;
+			if (offset >= matchLength) {
+				memcpy(out, match, matchLength);
+			} else {
+				for (size_t i = 0; i < matchLength; i++)
+					out[i] = match[i];
+			}
+			out += matchLength;
+		}
+
+		if (out != outEnd)
+			return false;
+
+		dst.assign(window.begin() + dictionarySize, window.end());
+		return true;
+	}
+
+private:
+	static void writeSequence(std::vector<u8>& dst, const u8* literals, size_t literalLength, size_t offset, size_t matchLength) {
+		using namespace impl;
+
+		const size_t matchCode = matchLength ? matchLength - lzMinMatch : 0;
+		dst.push_back((u8)((std::min<size_t>(literalLength, 15) << 4) | std::min<size_t>(matchCode, 15)));
+		if (literalLength >= 15)
+			lzWriteLength(dst, literalLength - 15);
+
+		dst.insert(dst.end(), literals, literals + literalLength);
+
+		if (!matchLength)
+			return;
+
+		dst.push_back((u8)(offset & 0xFF));
+		dst.push_back((u8)(offset >> 8));
+		if (matchCode >= 15)
+			lzWriteLength(dst, matchCode - 15);
+	}
+
+private:
+	std::vector<u8> window;
+	std::vector<u32> table;
+};
+
+AE_NAMESPACE_END
@@ -23,14 +23,60 @@ public:
         rot = newRot;
     }
 
+    // Same as setPos(getPos() + deltaPos) and setRot(getRot() + deltaRot), but without
+    // the round trip through origin. Used by impl::integrate.
+    void integrate(sf::Vector2f deltaPos, float deltaRot) {
+        lastPos = pos;
+        lastRot = rot;
+        pos += deltaPos;
+        rot += deltaRot;
+    }
+
     NODISCARD sf::Vector2f getOrigin() const { return origin; }
     void setOrigin(sf::Vector2f newOrigin) { origin = newOrigin; }
 
+    // Moves the transform without touching lastPos and lastRot. Used by InterpolationBuffer.
+    void setPose(sf::Vector2f unweightedPos, float newRot) {
+        pos = unweightedPos;
+        rot = newRot;
+    }
+
     template<typename S>
     void serialize(S& s) {
-        s.object(pos);
-        s.value4b(rot);
-        s.object(origin);
+        const QuantizationSettings& settings = getNetworkStateManager().getQuantizationSettings();
+        if (!settings.enabled) {
+            s.object(pos);
+            s.value4b(rot);
+            s.object(origin);
+            return;
+        }
+
+        s.enableBitPacking([&](typename S::BPEnabledType& sbp) {
+            const PhysicsWorld& world = getPhysicsWorld();
+            const AABB& bounds = world.isWrapping() ? world.getWrapBounds() : settings.positionBounds;
+
+            sf::Vector2f wrappedPos = world.wrapPosition(pos);
+            impl::serializeRanged(sbp, wrappedPos.x, bounds.min[0], bounds.max[0], settings.positionBits);
+            impl::serializeRanged(sbp, wrappedPos.y, bounds.min[1], bounds.max[1], settings.positionBits);
+            impl::serializeAngle(sbp, rot, settings.angleBits);
+
+            // most entities have no origin, those only pay a single bit for it. It can't be left out when
+            // unchanged, the receiver may not have the last one: it sees the whole component against any
+            // acked baseline, or for an entity that just spawned for it
+            bool hasOrigin = origin != sf::Vector2f(0.0f, 0.0f);
+            sbp.boolValue(hasOrigin);
+
+            sf::Vector2f newOrigin = origin;
+            if (hasOrigin) {
+                impl::serializeRanged(sbp, newOrigin.x, -settings.maxOrigin, settings.maxOrigin, settings.originBits);
+                impl::serializeRanged(sbp, newOrigin.y, -settings.maxOrigin, settings.maxOrigin, settings.originBits);
+            }
+
+            if constexpr (impl::IsDeserializer<S>::value) {
+                pos = wrappedPos;
+                origin = hasOrigin ? newOrigin : sf::Vector2f(0.0f, 0.0f);
+            }
+        });
     }
 
     NODISCARD bool isSameAsLast() const {
@@ -63,8 +109,18 @@ public:
 
     template<typename S>
     void serialize(S& s) {
-        s.object(linearVelocity);
-        s.value4b(angularVelocity);
+        const QuantizationSettings& settings = getNetworkStateManager().getQuantizationSettings();
+        if (!settings.enabled) {
+            s.object(linearVelocity);
+            s.value4b(angularVelocity);
+            return;
+        }
+
+        s.enableBitPacking([&](typename S::BPEnabledType& sbp) {
+            impl::serializeRanged(sbp, linearVelocity.x, -settings.maxLinearVelocity, settings.maxLinearVelocity, settings.linearVelocityBits);
+            impl::serializeRanged(sbp, linearVelocity.y, -settings.maxLinearVelocity, settings.maxLinearVelocity, settings.linearVelocityBits);
+            impl::serializeRanged(sbp, angularVelocity, -settings.maxAngularVelocity, settings.maxAngularVelocity, settings.angularVelocityBits);
+        });
     }
 
 protected:
@@ -95,6 +151,12 @@ private:
     float timeLeft;
 };
 
+/*
+ * Tags a networked entity this client simulates ahead of the server, see Prediction.
+ * Never networked, so the server and other clients don't see it.
+ */
+struct PredictedComponent {};
+
 struct CollisionEvent {
     CollisionEvent() = default;
     CollisionEvent(CollisionManifold manifold, flecs::entity self, flecs::entity other)
@@ -105,24 +167,232 @@ struct CollisionEvent {
     flecs::entity entityOther;
 };
 
+/* Emitted on a sensor's entity when another shape starts or stops overlapping it */
+struct SensorEvent {
+    SensorEvent() = default;
+    SensorEvent(bool entered, flecs::entity self, flecs::entity other)
+        : entered(entered), entitySelf(self), entityOther(other) {}
+
+    NODISCARD bool hasEntered() const { return entered; }
+    NODISCARD bool hasExited() const { return !entered; }
+
+    bool entered = false;
+    flecs::entity entitySelf; // the sensor
+    flecs::entity entityOther; // may no longer be alive on exit
+};
+
+/*
+ * Client side, smooths out networked entities that would otherwise jump at the rate snapshots arrive.
+ * Every applied snapshot is stored as a frame of TransformComponent poses stamped with its server time,
+ * or its arrival time until the ServerClock is synced. Server time keeps network jitter out of the motion.
+ * Every tick the entities are moved to where they were "delay" seconds ago, between the two frames
+ * around that time. The delay trades latency for smoothness, it should cover the time between two
+ * snapshots plus their jitter.
+ * 
+ * Frames are recycled, so once every frame has grown to the entity count it never allocates.
+ */
+class InterpolationBuffer {
+public:
+    static constexpr size_t defaultFrameCount = 16;
+    static constexpr float defaultDelay = 0.1f; // two snapshots at the default 20 network updates per second
+
+    InterpolationBuffer()
+        : frames(defaultFrameCount) {}
+
+    void setEnabled(bool isEnabled) { enabled = isEnabled; }
+    NODISCARD bool isEnabled() const { return enabled; }
+
+    void setDelay(float seconds) { delay = seconds; }
+    NODISCARD float getDelay() const { return delay; }
+
+    // more frames allow a longer delay
+    void setFrameCount(size_t count) {
+        assert(count >= 2);
+
+        frames.assign(count, Frame());
+        clear();
+    }
+
+    NODISCARD size_t getFrameCount() const { return frames.size(); }
+
+    void clear() {
+        frameCount = 0;
+    }
+
+    /* Puts every entity back where the newest snapshot left it, so the next one starts from authoritative poses */
+    void restoreNewest() {
+        if (frameCount == 0)
+            return;
+
+        for (const Pose& pose : getFrame(0).poses)
+            applyPose(pose.entity, pose.pos, pose.rot);
+    }
+
+    /* Stores the poses of all networked entities as the newest frame */
+    void capture(double time) {
+        // built here as this outlives the world it would have to be built with
+        if (!hasTransformQuery) {
+            transformQuery = getEntityWorld().query_builder<TransformComponent>()
+                .term<NetworkedEntity>()
+                .build();
+            hasTransformQuery = true;
+        }
+
+        newest = (newest + 1) % frames.size();
+        frameCount = std::min(frameCount + 1, frames.size());
+
+        Frame& frame = frames[newest];
+        frame.time = time;
+        frame.poses.clear();
+
+        transformQuery.iter([&](flecs::iter& iter, TransformComponent* transforms) {
+            for (auto i : iter)
+                frame.poses.push_back({ iter.entity(i).id(), transforms[i].getUnweightedPos(), transforms[i].getRot() });
+        });
+
+        std::sort(frame.poses.begin(), frame.poses.end());
+    }
+
+    /* Moves every entity in the newest frame to where it was at time - delay */
+    void interpolate(double time) {
+        if (frameCount == 0)
+            return;
+
+        const double renderTime = time - delay;
+
+        // the newest frame at or before renderTime, the frame after it is the one we move towards
+        size_t age = 0;
+        while (age + 1 < frameCount && getFrame(age).time > renderTime)
+            age++;
+
+        const Frame& from = getFrame(age);
+        if (age == 0 || from.time > renderTime) {
+            // nothing to interpolate between, hold the closest frame
+            for (const Pose& pose : from.poses)
+                applyPose(pose.entity, pose.pos, pose.rot);
+            return;
+        }
+
+        const Frame& to = getFrame(age - 1);
+        const float t = (float)((renderTime - from.time) / std::max(to.time - from.time, 1e-6));
+        const PhysicsWorld& physicsWorld = getPhysicsWorld();
+        constexpr float pi = 3.14159265f;
+
+        // both frames are sorted by entity, so the matching pose is found by walking them side by side
+        auto fromIt = from.poses.begin();
+        for (const Pose& target : to.poses) {
+            while (fromIt != from.poses.end() && fromIt->entity < target.entity)
+                ++fromIt;
+
+            if (fromIt == from.poses.end() || fromIt->entity != target.entity) {
+                applyPose(target.entity, target.pos, target.rot); // just appeared
+                continue;
+            }
+
+            // in wrap-around worlds, move across the edge instead of through the whole world
+            const sf::Vector2f fromPos = fromIt->pos + physicsWorld.getMinimumImageOffset(target.pos, fromIt->pos);
+            const float deltaRot = std::remainder(target.rot - fromIt->rot, 2.0f * pi);
+
+            applyPose(target.entity, fromPos + (target.pos - fromPos) * t, fromIt->rot + deltaRot * t);
+        }
+    }
+
+private:
+    struct Pose {
+        u64 entity; // with its generation, a full snapshot recreates every entity and flecs recycles their ids
+        sf::Vector2f pos; // unweighted
+        float rot;
+
+        bool operator<(const Pose& other) const { return entity < other.entity; }
+    };
+
+    struct Frame {
+        double time = 0.0;
+        std::vector<Pose> poses; // sorted by entity
+    };
+
+    // 0 is the newest frame
+    NODISCARD const Frame& getFrame(size_t age) const {
+        assert(age < frameCount);
+        return frames[(newest + frames.size() - age) % frames.size()];
+    }
+
+    static void applyPose(u64 entityId, sf::Vector2f pos, float rot) {
+        flecs::world& world = getEntityWorld();
+        if (!world.is_alive(entityId))
+            return;
+
+        flecs::entity entity = world.get_alive(entityId);
+        if (entity.has<PredictedComponent>())
+            return; // predicted entities are ahead of the snapshots, not behind them
+
+        TransformComponent* transform = entity.get_mut<TransformComponent>();
+        if (transform)
+            transform->setPose(pos, rot);
+    }
+
+    std::vector<Frame> frames;
+    size_t newest = 0;
+    size_t frameCount = 0;
+
+    bool enabled = true;
+    float delay = defaultDelay;
+
+    flecs::query<TransformComponent> transformQuery;
+    bool hasTransformQuery = false;
+};
 
 namespace impl {
-    inline void integrate(flecs::iter& iter, TransformComponent* transforms, IntegratableComponent* integratables) {
-        for(auto i : iter) {
-            TransformComponent& transform = transforms[i];
-            IntegratableComponent& integratable = integratables[i];
+    inline InterpolationBuffer interpolationBuffer;
+}
+
+inline InterpolationBuffer& getInterpolationBuffer() {
+    return impl::interpolationBuffer;
+}
+
+namespace impl {
+    inline struct {
+        // one bit per row of the table being integrated, set if the row must be marked modified
+        std::vector<u64> changed;
+    } integrateCache;
+
+    // one entity's step of impl::integrate, shared with Prediction's replay
+    inline void integrateStep(TransformComponent& transform, const IntegratableComponent& integratable, float deltaTime) {
+        transform.integrate(integratable.getLinearVelocity() * deltaTime, integratable.getAngularVelocity() * deltaTime);
+    }
+
+    inline void integrate(flecs::iter& iter, TransformComponent* __restrict transforms, IntegratableComponent* __restrict integratables) {
+        PhysicsPhaseTimer timer(PhysicsStats::PHASE_INTEGRATE);
+        const float deltaTime = iter.delta_time();
+        const size_t count = iter.count();
+
+        std::vector<u64>& changed = integrateCache.changed;
+        changed.assign((count + 63) / 64, 0); // only allocates when a bigger table shows up
 
-            transform.setPos(transform.getPos() + integratable.getLinearVelocity() * iter.delta_time());
-            transform.setRot(transform.getRot() + integratable.getAngularVelocity() * iter.delta_time());
+        // Branchless pass straight over the table columns, so the compiler is free to vectorize it
+        for (size_t i = 0; i < count; i++) {
+            const IntegratableComponent& integratable = integratables[i];
+
+            integrateStep(transforms[i], integratable, deltaTime);
+            changed[i >> 6] |= (u64)!integratable.isSameAsLast() << (i & 63);
+        }
+
+        // then only rows whose bit is set pay for the change notifications
+        for (size_t word = 0; word < changed.size(); word++) {
+            u64 bits = changed[word];
+
+            while (bits) {
+                size_t i = word * 64 + countTrailingZeros(bits);
+                bits &= bits - 1;
 
-            if (!integratable.isSameAsLast()) {
                 iter.entity(i).modified<IntegratableComponent>();
                 iter.entity(i).modified<TransformComponent>();
             }
-        }    
+        }
     }
 
     inline void shapeSet(flecs::iter& iter, TransformComponent* transforms, ShapeComponent* shapes) {
+        PhysicsPhaseTimer timer(PhysicsStats::PHASE_PRE_PHYSICS);
         PhysicsWorld& world = getPhysicsWorld();
 
         for (auto i : iter) {
@@ -133,53 +403,45 @@ namespace impl {
 
             Shape& shape = world.getShape(shapeId);
 
-            shape.setPos(transform.getUnweightedPos());
+            shape.setPos(world.wrapPosition(transform.getUnweightedPos()));
             shape.setRot(transform.getRot());
 
             world.insertShapeIntoTree(shapeId, iter.entity(i), shape.getCollisionMask());
         }
     }
 
-    inline bool testCollision(Shape& shape1, Shape& shape2, CollisionManifold& manifold) {
-        switch (shape1.getType()) {
-        case ShapeEnum::Polygon:
-            switch (shape2.getType()) {
-            case ShapeEnum::Polygon:
-                return testCollision(dynamic_cast<Polygon&>(shape1), dynamic_cast<Polygon&>(shape2), manifold);
-
-            case ShapeEnum::Circle:
-                return testCollision(dynamic_cast<Polygon&>(shape1), dynamic_cast<Circle&>(shape2), manifold);
-            default:
-                log(ERROR_SEVERITY_FATAL, "Invalid Shape Type");
-            } break;
-
-        case ShapeEnum::Circle:
-            switch (shape2.getType()) {
-            case ShapeEnum::Polygon:
-                return testCollision(dynamic_cast<Polygon&>(shape2), dynamic_cast<Circle&>(shape1), manifold);
-
-            case ShapeEnum::Circle:
-                return testCollision(dynamic_cast<Circle&>(shape1), dynamic_cast<Circle&>(shape2), manifold);
-
-            default:
-                log(ERROR_SEVERITY_FATAL, "Invalid Shape Type");
-            }
-
-        default:
-            log(ERROR_SEVERITY_FATAL, "Invalid Shape Type");
-            break;
-        }
-
-        return false; // silences warnings
+    inline bool testCollision(Shape& shape1, Shape& shape2, CollisionManifold& manifold, sf::Vector2f offset2 = {}) {
+        return visitShape(shape1, [&](auto& concrete1) {
+            return visitShape(shape2, [&](auto& concrete2) {
+                using Shape1 = std::decay_t<decltype(concrete1)>;
+                using Shape2 = std::decay_t<decltype(concrete2)>;
+
+                // polygon-circle tests only exist in that order, so the offset flips with the shapes
+                if constexpr (std::is_same_v<Shape1, Circle> && IsPolygon<Shape2>::value)
+                    return ::ae::testCollision(concrete2, concrete1, manifold, -offset2);
+                else
+                    return ::ae::testCollision(concrete1, concrete2, manifold, offset2);
+            });
+        });
     }
 
-    inline struct {
-        std::vector<SpatialIndexElement> results;
-    } physicsEcsCache;
+    inline bool testOverlap(Shape& shape1, Shape& shape2, sf::Vector2f offset2 = {}) {
+        return visitShape(shape1, [&](auto& concrete1) {
+            return visitShape(shape2, [&](auto& concrete2) {
+                using Shape1 = std::decay_t<decltype(concrete1)>;
+                using Shape2 = std::decay_t<decltype(concrete2)>;
+
+                if constexpr (std::is_same_v<Shape1, Circle> && IsPolygon<Shape2>::value)
+                    return ::ae::testOverlap(concrete2, concrete1, -offset2);
+                else
+                    return ::ae::testOverlap(concrete1, concrete2, offset2);
+            });
+        });
+    }
 
     inline void shapeCollide(flecs::iter& iter, ShapeComponent* shapes) {
+        PhysicsPhaseTimer timer(PhysicsStats::PHASE_MAIN_PHYSICS);
         PhysicsWorld& world = getPhysicsWorld();
-        SpatialIndexTree& tree = world.getTree();
 
         for (auto i : iter) {
             u32 shapeId = shapes[i].shape;
@@ -189,20 +451,35 @@ namespace impl {
             Shape& shape = world.getShape(shapeId);
             AABB aabb = shape.getAABB();
 
-            physicsEcsCache.results.clear();
-            tree.query(spatial::intersects<2>(aabb.min.data(), aabb.max.data()), std::back_inserter(physicsEcsCache.results));
-
-            for (SpatialIndexElement& element : physicsEcsCache.results) {
+            world.query(aabb, [&](SpatialIndexElement& element, sf::Vector2f offset) {
                 if (element.shapeId == shapeId)
-                    continue;
+                    return;
 
-                if ((shape.getCollisionMask() & element.collisionMask) > 0)
-                    continue;
+                if ((shape.getCollisionMask() & element.collisionMask) > 0) {
+                    AE_PHYSICS_STAT(world.getCurrentStats().pairsMasked++);
+                    return;
+                }
 
                 Shape& foundShape = world.getShape(element.shapeId);
 
+                // sensor pairs are only tested from the sensor's side, and sensors ignore eachother
+                if (shape.isSensor() || foundShape.isSensor()) {
+                    if (!shape.isSensor() || foundShape.isSensor())
+                        return;
+
+                    AE_PHYSICS_STAT(world.getCurrentStats().sensorTests++);
+                    if (testOverlap(shape, foundShape, offset)) {
+                        AE_PHYSICS_STAT(world.getCurrentStats().sensorHits++);
+                        world.reportSensorOverlap({ shapeId, impl::cf<u32>(iter.entity(i)), element.shapeId, element.entityId });
+                    }
+
+                    return;
+                }
+
                 CollisionManifold manifold;
-                if (testCollision(shape, foundShape, manifold)) {
+                AE_PHYSICS_STAT(world.getCurrentStats().narrowphaseTests++);
+                if (testCollision(shape, foundShape, manifold, offset)) {
+                    AE_PHYSICS_STAT(world.getCurrentStats().narrowphaseHits++);
                     iter.world()
                         .event<CollisionEvent>()
                         .id<ShapeComponent>()
@@ -210,11 +487,12 @@ namespace impl {
                         .ctx(CollisionEvent(manifold, iter.entity(i), iter.world().get_alive(element.entityId)))
                         .emit();
                 }
-            }
+            });
         }
     }
 
     inline void transformSet(flecs::iter& iter, TransformComponent* transforms, ShapeComponent* shapes) {
+        PhysicsPhaseTimer timer(PhysicsStats::PHASE_POST_PHYSICS);
         PhysicsWorld& world = getPhysicsWorld();
 
         for (auto i : iter) {
@@ -235,10 +513,79 @@ namespace impl {
         }
     }
 
+    inline void sensorUpdate(flecs::iter& iter) {
+        PhysicsPhaseTimer timer(PhysicsStats::PHASE_POST_PHYSICS);
+        PhysicsWorld& world = getPhysicsWorld();
+
+        world.updateSensors();
+
+        auto emit = [&](const PhysicsWorld::SensorOverlap& overlap, bool entered) {
+            flecs::entity sensor = iter.world().get_alive(overlap.sensorEntityId);
+            if (!sensor.is_valid())
+                return;
+
+            iter.world()
+                .event<SensorEvent>()
+                .id<ShapeComponent>()
+                .entity(sensor)
+                .ctx(SensorEvent(entered, sensor, iter.world().get_alive(overlap.otherEntityId)))
+                .emit();
+        };
+
+        for (const auto& overlap : world.getSensorEnters())
+            emit(overlap, true);
+        for (const auto& overlap : world.getSensorExits())
+            emit(overlap, false);
+    }
+
     inline void treeClear(flecs::iter& iter) {
+        PhysicsPhaseTimer timer(PhysicsStats::PHASE_TREE_CLEAR);
+
         getPhysicsWorld().clearTree();
     }
 
+    inline void poseHistoryCommit(flecs::iter& iter) {
+        PhysicsPhaseTimer timer(PhysicsStats::PHASE_POST_PHYSICS);
+
+        getPhysicsWorld().commitHistory(getCurrentTick());
+    }
+
+    inline bool interpolatesOnServerClock = false; // what the frames in the interpolation buffer are stamped with
+
+    inline void snapshotCapture() {
+        InterpolationBuffer& buffer = getInterpolationBuffer();
+        const bool onServerClock = getServerClock().isSynced();
+
+        // frames on different clocks can't be interpolated between
+        if (onServerClock != interpolatesOnServerClock) {
+            buffer.clear();
+            interpolatesOnServerClock = onServerClock;
+        }
+
+        if (onServerClock)
+            buffer.capture((double)getNetworkStateManager().getLastAppliedTick() / getTickRate());
+        else
+            buffer.capture(now<double, std::chrono::seconds::period>());
+    }
+
+    inline void snapshotInterpolate(flecs::iter& iter) {
+        InterpolationBuffer& buffer = getInterpolationBuffer();
+        if (!buffer.isEnabled())
+            return;
+
+        if (interpolatesOnServerClock) {
+            // the newest snapshot that could have arrived by now is half a round trip old
+            const ServerClock& clock = getServerClock();
+            buffer.interpolate(clock.getServerTime() - clock.getRtt() / 2.0);
+        } else {
+            buffer.interpolate(now<double, std::chrono::seconds::period>());
+        }
+    }
+
+    inline void physicsStatsEnd(flecs::iter& iter) {
+        getPhysicsWorld().endStatsTick();
+    }
+
     inline void onShapeDestroy(flecs::iter& iter, ShapeComponent* shapes) {
         PhysicsWorld& world = getPhysicsWorld();
 
@@ -262,21 +609,237 @@ namespace impl {
     }
 }
 
+/*
+ * Tests probe against every shape as it was on the given tick and calls
+ * callback(flecs::entity hit, const CollisionManifold& manifold) for each collision.
+ * Meant for validating hits reported by clients, who see the world RTT/2 plus their interpolation delay late.
+ * Requires PhysicsWorld::setHistoryLength(), returns false if tick is not in the history.
+ */
+template<typename F>
+bool collideAtTick(u64 tick, Shape& probe, F&& callback) {
+    PhysicsWorld& world = getPhysicsWorld();
+    flecs::world& entityWorld = getEntityWorld();
+
+    return world.queryRewound(tick, probe.getAABB(), [&](Shape& shape, const PhysicsWorld::ShapePose& pose, sf::Vector2f offset) {
+        if (&shape == &probe || shape.isSensor() || (probe.getCollisionMask() & pose.collisionMask) > 0)
+            return;
+
+        CollisionManifold manifold;
+        if (impl::testCollision(probe, shape, manifold, offset)) {
+            flecs::entity hit = entityWorld.get_alive(pose.entityId);
+            if (hit.is_valid())
+                callback(hit, manifold);
+        }
+    });
+}
+
+/*
+ * Client side prediction of the entities this client controls, e.g. its player.
+ * 
+ * Every tick the game passes its input to applyInput(), which stores it and applies it to every
+ * entity tagged with PredictedComponent through the "apply" callback. The regular CoreModule
+ * systems then move them, so the client sees its input take effect immediately.
+ * 
+ * The server tells the client which input it applied last, see acknowledge() and InputChannel. When a snapshot puts
+ * the predicted entities back to the server's state, every input after that one is applied again.
+ * Each replayed tick only integrates the predicted entities, the rest of the world and collisions are
+ * not simulated again.
+ */
+template<typename Input>
+class Prediction {
+public:
+    // applies input to a predicted entity, called for live and replayed ticks alike
+    using ApplyFunction = std::function<void(flecs::entity entity, const Input& input, float deltaTime)>;
+
+    // 2.1 seconds at 60 ticks per second, inputs older than the round trip time are never replayed
+    static constexpr size_t defaultHistoryLength = 128;
+
+    explicit Prediction(ApplyFunction apply, size_t historyLength = defaultHistoryLength)
+        : apply(std::move(apply)), history(historyLength) {
+        assert(historyLength > 0);
+
+        predictedQuery = getEntityWorld().query_builder<TransformComponent>()
+            .term<PredictedComponent>()
+            .build();
+
+        callbacksId = getNetworkStateManager().addSnapshotApplyCallbacks(
+            [this] { restoreAuthoritative(); },
+            [this] { reconcile(); });
+    }
+
+    ~Prediction() {
+        getNetworkStateManager().removeSnapshotApplyCallbacks(callbacksId);
+        predictedQuery.destruct();
+    }
+
+    Prediction(const Prediction&) = delete;
+    Prediction& operator=(const Prediction&) = delete;
+
+    /*
+     * entity must be networked. It is tracked by its network id, so it stays predicted when a full snapshot
+     * deletes and recreates it.
+     */
+    void predict(flecs::entity entity) {
+        NetworkStateManager& stateManager = getNetworkStateManager();
+        const u32 netId = stateManager.getNetId(entity);
+        assert(netId && "only networked entities can be predicted");
+
+        predicted[netId] = stateManager.getNetGeneration(netId);
+        entity.add<PredictedComponent>();
+    }
+
+    void stopPredicting(flecs::entity entity) {
+        const u32 netId = getNetworkStateManager().getNetId(entity);
+        predicted.erase(netId);
+        authoritative.erase(netId);
+        entity.remove<PredictedComponent>();
+    }
+
+    /* Stores input as this tick's and applies it to every predicted entity */
+    void applyInput(const Input& input) {
+        const u64 tick = getCurrentTick();
+
+        StoredInput& stored = history[tick % history.size()];
+        stored.tick = tick;
+        stored.valid = true;
+        stored.input = input;
+
+        const float deltaTime = 1.0f / impl::getTickRate();
+        predictedQuery.iter([&](flecs::iter& iter, TransformComponent*) {
+            for (auto i : iter)
+                apply(iter.entity(i), input, deltaTime);
+        });
+    }
+
+    /* The input of tick, nullptr if it is not in the history */
+    NODISCARD const Input* getInput(u64 tick) const {
+        const StoredInput& stored = history[tick % history.size()];
+        return stored.valid && stored.tick == tick ? &stored.input : nullptr;
+    }
+
+    /*
+     * tick is the newest input the server applied, the next snapshot reflects every input up to it.
+     * Inputs sent through an InputChannel are acknowledged automatically.
+     */
+    void acknowledge(u64 tick) {
+        acknowledged = std::max(acknowledged, tick);
+    }
+
+    NODISCARD u64 getAcknowledged() const { return acknowledged; }
+
+private:
+    struct StoredInput {
+        u64 tick = 0;
+        bool valid = false;
+        Input input;
+    };
+
+    struct AuthoritativeState {
+        TransformComponent transform;
+        IntegratableComponent integratable;
+        bool hasIntegratable = false;
+    };
+
+    // snapshots leave entities they have nothing new for alone, those must not keep the predicted state
+    void restoreAuthoritative() {
+        NetworkStateManager& stateManager = getNetworkStateManager();
+        for (auto& pair : authoritative) {
+            flecs::entity entity = stateManager.getNetEntity(pair.first);
+            if (!entity.is_valid() || !entity.has<PredictedComponent>())
+                continue;
+
+            if (TransformComponent* transform = entity.get_mut<TransformComponent>())
+                *transform = pair.second.transform;
+            if (pair.second.hasIntegratable)
+                if (IntegratableComponent* integratable = entity.get_mut<IntegratableComponent>())
+                    *integratable = pair.second.integratable;
+        }
+    }
+
+    void reconcile() {
+        const float deltaTime = 1.0f / impl::getTickRate();
+        const u64 currentTick = getCurrentTick();
+
+        NetworkStateManager& stateManager = getNetworkStateManager();
+        acknowledge(stateManager.getAppliedInputAck());
+
+        // a full snapshot recreates every networked entity without the tag, a new generation is another entity
+        for (auto it = predicted.begin(); it != predicted.end();) {
+            flecs::entity entity = stateManager.getNetEntity(it->first);
+            if (!entity.is_valid() || stateManager.getNetGeneration(it->first) != it->second) {
+                it = predicted.erase(it);
+                continue;
+            }
+
+            if (!entity.has<PredictedComponent>())
+                entity.add<PredictedComponent>();
+            ++it;
+        }
+
+        authoritative.clear();
+        predictedQuery.iter([&](flecs::iter& iter, TransformComponent* transforms) {
+            for (auto i : iter) {
+                flecs::entity entity = iter.entity(i);
+                const IntegratableComponent* integratable = entity.get<IntegratableComponent>();
+
+                AuthoritativeState& state = authoritative[stateManager.getNetId(entity)];
+                state.transform = transforms[i];
+                state.hasIntegratable = integratable != nullptr;
+                if (integratable)
+                    state.integratable = *integratable;
+            }
+        });
+
+        // replay every input the server has not seen yet, oldest first
+        const u64 firstTick = std::max(acknowledged + 1, currentTick > history.size() ? currentTick - history.size() : 0);
+        for (u64 tick = firstTick; tick < currentTick; tick++) {
+            const Input* input = getInput(tick);
+            if (!input)
+                continue;
+
+            predictedQuery.iter([&](flecs::iter& iter, TransformComponent* transforms) {
+                for (auto i : iter) {
+                    flecs::entity entity = iter.entity(i);
+                    apply(entity, *input, deltaTime);
+
+                    if (const IntegratableComponent* integratable = entity.get<IntegratableComponent>())
+                        impl::integrateStep(transforms[i], *integratable, deltaTime);
+                }
+            });
+        }
+    }
+
+    ApplyFunction apply;
+    std::vector<StoredInput> history; // indexed by tick
+    u64 acknowledged = 0;
+
+    impl::FastMap<u32, u8> predicted; // generations, by network id
+    impl::FastMap<u32, AuthoritativeState> authoritative; // what the last snapshot said, by network id
+    flecs::query<TransformComponent> predictedQuery;
+    u32 callbacksId = 0;
+};
+
 /*
  * The core module defines and declares all of the important necessary components and systems
  * that allow the engine to work
  */
 struct CoreModule {
+    inline static flecs::entity netSync;
     inline static flecs::entity treeClear;
     inline static flecs::entity prePhysics;
     inline static flecs::entity mainPhysics;
     inline static flecs::entity postPhysics;
 
     explicit CoreModule(flecs::world& world) {
-        treeClear = world.entity()
+        // networked entities are put where they are shown before physics sees them
+        netSync = world.entity()
             .add(flecs::Phase)
             .depends_on(flecs::OnUpdate);
 
+        treeClear = world.entity()
+            .add(flecs::Phase)
+            .depends_on(netSync);
+
         prePhysics = world.entity()
             .add(flecs::Phase)
             .depends_on(treeClear);
@@ -289,18 +852,20 @@ struct CoreModule {
             .add(flecs::Phase)
             .depends_on(mainPhysics);
 
+        world.system().kind(netSync).iter(impl::snapshotInterpolate);
         world.system().kind(treeClear).iter(impl::treeClear);
         world.system<TransformComponent, ShapeComponent>().kind(prePhysics).iter(impl::shapeSet);
         world.system<ShapeComponent>().kind(mainPhysics).iter(impl::shapeCollide);
         world.system<TransformComponent, ShapeComponent>().kind(postPhysics).iter(impl::transformSet);
+        world.system().kind(postPhysics).iter(impl::sensorUpdate);
+        world.system().kind(postPhysics).iter(impl::poseHistoryCommit);
+        world.system().kind(postPhysics).iter(impl::physicsStatsEnd); // keep this the last physics system
         world.system<TransformComponent, IntegratableComponent>().iter(impl::integrate);
 
         world.system<TimedDeleteComponent>().iter(impl::isTimedDeleteDone);
     }
 
     static void registerCore() {
-        getEntityWorld().enable_range_check(false);
-
         NetworkStateManager& manager = getNetworkStateManager();
         manager.registerComponent<TransformComponent>();
         manager.registerComponent<ShapeComponent>(ComponentPiority::High);
@@ -308,7 +873,9 @@ struct CoreModule {
 
         getEntityWorld().observer<ShapeComponent>().event(flecs::OnRemove).iter(impl::onShapeDestroy);
 
-        getEntityWorld().enable_range_check(true);
+        manager.addSnapshotApplyCallbacks(
+            [] { getInterpolationBuffer().restoreNewest(); },
+            impl::snapshotCapture);
     }
 };
 
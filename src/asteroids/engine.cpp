@@ -53,6 +53,10 @@ namespace impl {
 		return engine->ticker.getRate();
 	}
 
+	float getTickProgress() {
+		return engine->ticker.getProgress();
+	}
+
 	u64 _registerState(std::shared_ptr<State> ptr, std::type_index typeId) {
 		if(typeId.hash_code() > UINT64_MAX)
 			log(ERROR_SEVERITY_FATAL, "Hashcode of state surpassed max u64\n");
@@ -16,6 +16,7 @@ namespace impl {
 	void _registerNetworkStateModule(flecs::entity module, std::type_index networkInterfaceId, u64 stateId);
 
 	float getTickRate();
+	float getTickProgress(); // how far into the next tick we are, from 0 to 1
 
 	FastMap<u64, u64>& getStateIdTranslationTable();
 }
@@ -9,6 +9,14 @@
 #include <variant>
 #include <bitset>
 #include <set>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 // Boost
 #include <boost/container/flat_map.hpp>
@@ -36,6 +44,8 @@ using json = nlohmann::json;
 #include <bitsery/traits/string.h>
 #include <bitsery/traits/array.h>
 #include <bitsery/ext/inheritance.h>
+#include <bitsery/ext/value_range.h>
+#include <bitsery/ext/compact_value.h>
 
 // User I/O
 #include <SFML/Graphics.hpp>
@@ -142,6 +152,18 @@ namespace impl {
 	inline flecs::entity af(Integer id) {
 		return getEntityWorld().get_alive((u64)id);
 	}
+
+	// Index of the lowest set bit. bits must not be zero.
+	inline u32 countTrailingZeros(u64 bits) {
+		assert(bits != 0);
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, bits);
+		return (u32)index;
+#else
+		return (u32)__builtin_ctzll(bits);
+#endif
+	}
 }
 
 AE_NAMESPACE_END
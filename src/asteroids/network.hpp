@@ -2,6 +2,7 @@
 
 #include "logging.hpp"
 #include "physics.hpp"
+#include "compression.hpp"
 
 namespace bitsery {
 	template<typename S>
@@ -41,6 +42,299 @@ namespace bitsery {
 
 AE_NAMESPACE_BEGIN
 
+namespace impl {
+	/*
+	 * Recycles the memory of MessageBuffers, so sending a snapshot every network update doesn't
+	 * hit the heap once the pool has warmed up.
+	 * 
+	 * Blocks come in power of two size classes from minBlockSize up to maxPooledSize, bigger ones
+	 * are allocated and freed directly. Every block starts with a header holding a reference count,
+	 * so a buffer sent to many connections at once is shared by them and returns to the pool when
+	 * the last message is freed. GameNetworkingSockets may free messages on its own thread, so
+	 * the free lists are locked.
+	 */
+	class MessageBufferPool {
+	public:
+		static constexpr size_t minBlockSize = 128;
+		static constexpr size_t sizeClassCount = 14; // up to 1 MiB
+		static constexpr size_t maxPooledSize = minBlockSize << (sizeClassCount - 1);
+		static constexpr size_t maxFreeBlocks = 64; // per size class, more are freed
+
+		struct Stats {
+			size_t heapAllocations = 0;
+			size_t reuses = 0;
+		};
+
+		MessageBufferPool() = default;
+		MessageBufferPool(const MessageBufferPool&) = delete;
+		MessageBufferPool& operator=(const MessageBufferPool&) = delete;
+
+		// blocks still in use must not be released afterwards
+		~MessageBufferPool() {
+			for (BlockHeader* block : freeBlocks) {
+				while (block) {
+					BlockHeader* next = block->nextFree;
+					block->~BlockHeader();
+					::operator delete(block);
+					block = next;
+				}
+			}
+		}
+
+		/* Returns a block of at least size bytes with a single reference, capacity is set to its real size */
+		u8* allocate(size_t size, size_t& capacity) {
+			const u32 sizeClass = getSizeClass(size);
+			capacity = sizeClass < sizeClassCount ? minBlockSize << sizeClass : size;
+
+			if (sizeClass < sizeClassCount) {
+				std::lock_guard<std::mutex> lock(mutex);
+
+				BlockHeader* block = freeBlocks[sizeClass];
+				if (block) {
+					freeBlocks[sizeClass] = block->nextFree;
+					freeCounts[sizeClass]--;
+					stats.reuses++;
+
+					block->references.store(1, std::memory_order_relaxed);
+					return (u8*)(block + 1);
+				}
+
+				stats.heapAllocations++;
+			}
+
+			BlockHeader* block = new (::operator new(sizeof(BlockHeader) + capacity)) BlockHeader();
+			block->sizeClass = sizeClass;
+			block->references.store(1, std::memory_order_relaxed);
+			return (u8*)(block + 1);
+		}
+
+		void addReferences(u8* data, u32 count) {
+			getHeader(data)->references.fetch_add(count, std::memory_order_relaxed);
+		}
+
+		/* Drops a reference to data, the last one returns it to the pool */
+		void release(u8* data) {
+			BlockHeader* block = getHeader(data);
+			if (block->references.fetch_sub(1, std::memory_order_acq_rel) != 1)
+				return;
+
+			if (block->sizeClass < sizeClassCount) {
+				std::lock_guard<std::mutex> lock(mutex);
+
+				if (freeCounts[block->sizeClass] < maxFreeBlocks) {
+					block->nextFree = freeBlocks[block->sizeClass];
+					freeBlocks[block->sizeClass] = block;
+					freeCounts[block->sizeClass]++;
+					return;
+				}
+			}
+
+			block->~BlockHeader();
+			::operator delete(block);
+		}
+
+		NODISCARD Stats getStats() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return stats;
+		}
+
+	private:
+		struct alignas(16) BlockHeader {
+			std::atomic<u32> references{ 0 };
+			u32 sizeClass = 0; // sizeClassCount if the block is not pooled
+			BlockHeader* nextFree = nullptr;
+		};
+
+		static BlockHeader* getHeader(u8* data) {
+			return (BlockHeader*)data - 1;
+		}
+
+		static u32 getSizeClass(size_t size) {
+			if (size > maxPooledSize)
+				return (u32)sizeClassCount;
+
+			u32 sizeClass = 0;
+			while ((minBlockSize << sizeClass) < size)
+				sizeClass++;
+
+			return sizeClass;
+		}
+
+		std::mutex mutex;
+		std::array<BlockHeader*, sizeClassCount> freeBlocks{};
+		std::array<size_t, sizeClassCount> freeCounts{};
+		Stats stats;
+	};
+
+	// never destroyed, GameNetworkingSockets may still free messages while the program shuts down
+	inline MessageBufferPool& getMessageBufferPool() {
+		static MessageBufferPool* pool = new MessageBufferPool();
+		return *pool;
+	}
+
+	/*
+	 * Threads that wait for parallelFor() to hand them work. The calling thread works along, so a pool
+	 * without threads runs everything on the caller.
+	 */
+	class WorkerPool {
+	public:
+		WorkerPool() = default;
+		~WorkerPool() { setThreadCount(0); }
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+
+		/* Must not be called during parallelFor() */
+		void setThreadCount(size_t count) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+
+			for (std::thread& thread : threads)
+				thread.join();
+
+			threads.clear();
+			stopping = false;
+
+			// taken here, a worker that starts late must still take part in the next parallelFor()
+			const u64 startGeneration = generation;
+			for (size_t i = 0; i < count; i++)
+				threads.emplace_back([this, i, startGeneration]() { workerLoop(i + 1, startGeneration); });
+		}
+
+		NODISCARD size_t getThreadCount() const { return threads.size(); }
+
+		/*
+		 * Calls f(size_t index, size_t worker) for every index in [0, count) and returns once all calls are done.
+		 * worker is in [0, getThreadCount()], 0 being the calling thread, so per worker scratch can be indexed by it.
+		 */
+		template<typename F>
+		void parallelFor(size_t count, F&& f) {
+			using Function = std::remove_reference_t<F>;
+
+			if (threads.empty() || count <= 1) {
+				for (size_t i = 0; i < count; i++)
+					f(i, 0);
+				return;
+			}
+
+			Task task;
+			task.count = count;
+			task.context = (void*)&f;
+			task.run = [](void* context, size_t index, size_t worker) { (*(Function*)context)(index, worker); };
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				current = &task;
+				nextIndex = 0;
+				busyWorkers = threads.size();
+				generation++;
+			}
+			wake.notify_all();
+
+			runTask(task, 0);
+
+			std::unique_lock<std::mutex> lock(mutex);
+			done.wait(lock, [&]() { return busyWorkers == 0; });
+			current = nullptr;
+		}
+
+	private:
+		struct Task {
+			size_t count = 0;
+			void* context = nullptr;
+			void(*run)(void* context, size_t index, size_t worker) = nullptr;
+		};
+
+		void runTask(const Task& task, size_t worker) {
+			for (size_t i = nextIndex++; i < task.count; i = nextIndex++)
+				task.run(task.context, i, worker);
+		}
+
+		void workerLoop(size_t worker, u64 seenGeneration) {
+			while (true) {
+				const Task* task = nullptr;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+					if (stopping)
+						return;
+
+					seenGeneration = generation;
+					task = current;
+				}
+
+				runTask(*task, worker);
+
+				std::lock_guard<std::mutex> lock(mutex);
+				if (--busyWorkers == 0)
+					done.notify_one();
+			}
+		}
+
+		std::vector<std::thread> threads;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+
+		const Task* current = nullptr;
+		std::atomic<size_t> nextIndex{ 0 };
+		size_t busyWorkers = 0;
+		u64 generation = 0;
+		bool stopping = false;
+	};
+
+	/*
+	 * A fixed size ring buffer one thread pushes to and another pops from, without locking.
+	 * The capacity is rounded up to a power of two.
+	 */
+	template<typename T>
+	class SpscQueue {
+	public:
+		explicit SpscQueue(size_t capacity) {
+			size_t size = 1;
+			while (size < capacity)
+				size <<= 1;
+
+			slots.resize(size);
+		}
+
+		SpscQueue(const SpscQueue&) = delete;
+		SpscQueue& operator=(const SpscQueue&) = delete;
+
+		/* Producer side, false if the queue is full */
+		bool push(const T& value) {
+			const size_t tail = this->tail.load(std::memory_order_relaxed);
+			if (tail - head.load(std::memory_order_acquire) == slots.size())
+				return false;
+
+			slots[tail & (slots.size() - 1)] = value;
+			this->tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		/* Consumer side, false if the queue is empty */
+		bool pop(T& value) {
+			const size_t head = this->head.load(std::memory_order_relaxed);
+			if (head == tail.load(std::memory_order_acquire))
+				return false;
+
+			value = slots[head & (slots.size() - 1)];
+			this->head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+	private:
+		std::vector<T> slots;
+
+		// on their own cache lines, so the two threads don't fight over one
+		alignas(64) std::atomic<size_t> head{ 0 };
+		alignas(64) std::atomic<size_t> tail{ 0 };
+	};
+}
+
 /**
  * MessageBuffer is a simple dynamic array where elements cannot be removed, only added.
  * 
@@ -50,12 +344,20 @@ AE_NAMESPACE_BEGIN
  * its free callback is called (SteamNetworkingMessage::m_pfnFreeData). std::vector<>
  * only allows ownership to be transferred through move semantics and not raw pointers and
  * SteamNetworkingMessage uses raw pointers and not STL containers.
+ * 
+ * Owned memory comes from impl::MessageBufferPool and is reference counted, see NetworkManager::sendShared().
  */
 struct MessageBuffer {
 public:
+	static constexpr size_t defaultCapacity = 128;
+
 	MessageBuffer()
+		: MessageBuffer(defaultCapacity) {}
+
+	// reserves at least capacity bytes, e.g. the size of the last message of the same kind
+	explicit MessageBuffer(size_t capacity)
 		: capacity(0), size(0), data(nullptr), hasOwnership(true) {
-		allocateIfNoData(128);
+		allocateIfNoData(std::max<size_t>(capacity, 1));
 	}
 
 	// data must be a pointer allocated to on the heap
@@ -66,18 +368,32 @@ public:
 
 
 	MessageBuffer(MessageBuffer&& other) noexcept
-		: capacity(other.capacity), size(other.size), data(other.data), hasOwnership(true) {
+		: capacity(other.capacity), size(other.size), data(other.data), hasOwnership(other.hasOwnership) {
 		other.setOwner(false);
 		other.reset();
 	}
 
+	MessageBuffer& operator=(MessageBuffer&& other) noexcept {
+		if (this != &other) {
+			reset();
+			setData(other.size, other.data, other.hasOwnership);
+			capacity = other.capacity;
+
+			other.setOwner(false);
+			other.reset();
+		}
+
+		return *this;
+	}
+
 	~MessageBuffer() {
 		if (hasOwnership && data) {
-			delete[] data;
+			impl::getMessageBufferPool().release(data);
 		}
 	}
 
 	NODISCARD size_t getSize() const { return size; }
+	NODISCARD size_t getCapacity() const { return capacity; }
 	NODISCARD const u8* getData() const { return data; }
 	u8* getData() { return data; }
 	NODISCARD bool isOwner() const { return hasOwnership; }
@@ -87,6 +403,22 @@ public:
 		hasOwnership = isOwner;
 	}
 
+	/*
+	 * Another owner of the same data, which goes back to the pool once every owner is gone. Neither
+	 * may be written to afterwards, the data is shared and not copied.
+	 */
+	NODISCARD MessageBuffer share() const {
+		assert(hasOwnership && data);
+
+		impl::getMessageBufferPool().addReferences(data, 1);
+
+		MessageBuffer shared(size, data);
+		shared.capacity = capacity;
+		shared.setOwner(true);
+		return shared;
+	}
+
+	// owned data must come from impl::MessageBufferPool
 	void setData(size_t newSize, u8* newData, bool isOwner = true) {
 		this->capacity = newSize;
 		this->size = newSize;
@@ -106,14 +438,12 @@ public:
 		// if the requested size is more then the current capacity
 		// resize to match it and copy over old data
 		if (newSize > capacity) {
-			size_t newCapacity = newSize * 2;
 			u8* oldData = data;
-			data = new u8[newCapacity];
+			data = impl::getMessageBufferPool().allocate(newSize * 2, capacity);
 
 			memcpy(data, oldData, size);
-			capacity = newCapacity;
 			size = newSize;
-			delete[] oldData;
+			impl::getMessageBufferPool().release(oldData);
 		}
 		else {
 			size = newSize;
@@ -127,7 +457,7 @@ public:
 	// will reset all members and will delete data if it has ownership.
 	void reset() {
 		if (hasOwnership && data) {
-			delete[] data;
+			impl::getMessageBufferPool().release(data);
 		}
 
 		setData(0, nullptr, true);
@@ -158,15 +488,14 @@ protected:
 		if (data)
 			return false;
 
-		data = new u8[newSize];
-		capacity = newSize;
+		data = impl::getMessageBufferPool().allocate(newSize, capacity);
 		size = 0;
 		hasOwnership = true;
 		return true;
 	}
 
 private:
-	size_t capacity; // Optimizations for capacity not yet added
+	size_t capacity;
 	size_t size;
 	u8* data;
 	bool hasOwnership;
@@ -237,6 +566,14 @@ enum MessageHeader: u8 {
 	MESSAGE_HEADER_DELTA_SNAPSHOT,
 	MESSAGE_HEADER_REQUEST_FULL_SNAPSHOT,
 	MESSAGE_HEADER_FULL_SNAPSHOT,
+	MESSAGE_HEADER_SNAPSHOT_ACK,
+	MESSAGE_HEADER_COMPRESSION_OFFER,
+	MESSAGE_HEADER_COMPRESSED, // wraps another message, see NetworkManager::enableCompression()
+	MESSAGE_HEADER_INPUT, // see InputChannel
+	MESSAGE_HEADER_INPUT_ACK,
+	MESSAGE_HEADER_TIME_PING, // see ServerClock
+	MESSAGE_HEADER_TIME_PONG,
+	MESSAGE_HEADER_SCHEMA, // see NetworkStateManager::getSchemaHash()
 	MESSAGE_HEADER_CORE_LAST // it is named core in the case end-users also want to have multiple MessageHeader enums
 };
 
@@ -249,11 +586,7 @@ namespace impl {
 	ISteamNetworkingUtils* getUtils();
 	ISteamNetworkingSockets* getSockets();
 	extern float getTickRate();
-
-	struct MessageBufferMeta {
-		u32 messagesSent = 0;
-		u32 messagesFreed = 0;
-	};
+	extern float getTickProgress();
 }
 
 /**
@@ -296,6 +629,8 @@ public:
 
 	virtual void _internalOnConnectionJoin(HSteamNetConnection conn) {}
 
+	virtual void _internalOnConnectionLeave(HSteamNetConnection conn) {}
+
 	virtual void _internalUpdate() {}
 };
 
@@ -320,6 +655,8 @@ public:
 	}
 
 	~NetworkManager() {
+		stopNetworkThread();
+
 		if(networkInterface) {
 			if(networkInterface->isOpen()) {
 				close();
@@ -360,6 +697,23 @@ public:
 		return dynamic_cast<T*>(&*networkInterface) != nullptr;
 	}
 
+	using MessageHandler = std::function<void(HSteamNetConnection conn, Deserializer& des)>;
+
+	/*
+	 * Messages with the given header go to handler instead of the network interface, e.g.
+	 * MESSAGE_HEADER_INPUT goes to InputChannel. A null handler removes it.
+	 */
+	void setMessageHandler(MessageHeader header, MessageHandler handler) {
+		if(handler)
+			messageHandlers[header] = std::move(handler);
+		else
+			messageHandlers.erase(header);
+	}
+
+	NODISCARD bool hasConnection(HSteamNetConnection conn) const {
+		return connections.find(conn) != connections.end();
+	}
+
 	/**
 	 * Will send a message containing "data" to the connection "who"
 	 * 
@@ -372,86 +726,48 @@ public:
 		MessageBuffer messageBuffer = std::move(messageBuffer_);
 		assert(messageBuffer.isOwner() && messageBuffer.getData());
 
-		int steamMessageFlags = 0;
-		if(sendReliable) {
-			steamMessageFlags = k_nSteamNetworkingSend_Reliable | k_nSteamNetworkingSend_AutoRestartBrokenSession;
-		} else {
-			steamMessageFlags = k_nSteamNetworkingSend_Unreliable;
-		}
-
-		stats.writtenBytes += messageBuffer.getSize();
-
 		EResult result = k_EResultOK;
 		if(sendAll) {
-
-			// MessageBufferMeta will keep track how many messages
-			// need to be sent and how many have been free'd.
-			// This allows multiple messages to use the same buffer.
-			// (check message.m_pfnFreeData below for implementation)
-			//
-			// Note: I haven't checked the performance gain of only one MessageBuffer.
-			// But I think it is reasonable to assume that:
-			// ---
-			// 2 calls on the heap (One for the MessageBuffer and one MessageBufferMeta) 
-			// - Vs. -
-			// AT A MINIMUM 1 heap call but possibly up whatever the max connections is PLUS copying the contents of MessageBuffer everwhere
-			// ---
-			// that the former is much faster.
-			auto meta = new impl::MessageBufferMeta;
-
+			sendTargets.clear();
 			for (auto& pair : connections) {
-				if (pair.first == who)
-					continue;
-
-				networkingMessages.push_back(impl::getUtils()->AllocateMessage(0));
-				ISteamNetworkingMessage& message = *networkingMessages.back();
-
-				message.m_conn = pair.first;
-				message.m_cbSize = (int)messageBuffer.getSize();
-				message.m_pData = (void*)messageBuffer.getData();
-				message.m_nFlags = steamMessageFlags;
-				message.m_nUserData = (int64)meta;
-
-				message.m_pfnFreeData = 
-					[](ISteamNetworkingMessage* message){
-						auto meta = (impl::MessageBufferMeta*)message->m_nUserData;
-
-						meta->messagesFreed++;
-						if(meta->messagesFreed == meta->messagesSent) {
-							delete[] (u8*)message->m_pData;
-							delete meta;						
-						}
-					};
-				
-				meta->messagesSent++;
-			}
-
-			if(networkingMessages.empty()) {
-				delete meta;
-				return;
+				if (pair.first != who)
+					sendTargets.push_back(pair.first);
 			}
 
-			std::vector<int64_t> results;
-			results.resize(networkingMessages.size());
-
-			messageBuffer.setOwner(false);
-			impl::getSockets()->SendMessages((int)networkingMessages.size(), networkingMessages.data(), (int64*)results.data());
-			networkingMessages.clear();
-		
-			for(int64_t messageResult : results) {
-				if(messageResult < 0) {
-					result = (EResult)-messageResult;
-					break;
-				}
-			}
-		
+			result = sendToConnections(sendTargets, std::move(messageBuffer), getSendFlags(sendReliable));
 		} else {
 			if(connections.find(who) == connections.end())
 				log(ERROR_SEVERITY_FATAL, "Cannot send a message to an invalid connection: %u\n", who);
 
-			result = impl::getSockets()->SendMessageToConnection(who, messageBuffer.getData(), (u32)messageBuffer.getSize(), steamMessageFlags, nullptr);
+			recordCompressionSample(messageBuffer);
+
+			const MessageBuffer* toSend = &messageBuffer;
+			if(tryCompress(messageBuffer, connections[who].compression, compressedBuffer))
+				toSend = &compressedBuffer;
+
+			stats.writtenBytes += toSend->getSize();
+			result = impl::getSockets()->SendMessageToConnection(who, toSend->getData(), (u32)toSend->getSize(), getSendFlags(sendReliable), nullptr);
+		}
+
+		if(result != k_EResultOK) {
+			log(ERROR_SEVERITY_WARNING, "Failed to send message: %i\n", result);
+		}
+	}
+
+	/**
+	 * Will send a message containing "data" to every connection in "targets".
+	 * All of the messages share the same buffer, so nothing is copied.
+	 */
+	void sendMessage(const std::vector<HSteamNetConnection>& targets, MessageBuffer&& messageBuffer_, bool sendReliable = false) {
+		MessageBuffer messageBuffer = std::move(messageBuffer_);
+		assert(messageBuffer.isOwner() && messageBuffer.getData());
+
+		for (HSteamNetConnection target : targets) {
+			if (connections.find(target) == connections.end())
+				log(ERROR_SEVERITY_FATAL, "Cannot send a message to an invalid connection: %u\n", target);
 		}
 
+		EResult result = sendToConnections(targets, std::move(messageBuffer), getSendFlags(sendReliable));
 		if(result != k_EResultOK) {
 			log(ERROR_SEVERITY_WARNING, "Failed to send message: %i\n", result);
 		}
@@ -461,31 +777,63 @@ public:
 		if(!hasNetworkInterface())
 			return;
 
-		impl::getSockets()->RunCallbacks();
+		// the network thread receives instead, see startNetworkThread()
+		if(!hasNetworkThread()) {
+			impl::getSockets()->RunCallbacks();
 
-		ISteamNetworkingMessage* message = nullptr;
-		while(impl::getSockets()->ReceiveMessagesOnPollGroup(pollGroup, &message, 1)) {
-			Deserializer des = startDeserialize(message->GetSize(), message->GetData());
-			MessageHeader header = MESSAGE_HEADER_INVALID;
+			int count = 0;
+			while((count = impl::getSockets()->ReceiveMessagesOnPollGroup(pollGroup, receiveBatch.data(), (int)receiveBatch.size())) > 0) {
+				for(int i = 0; i < count; i++) {
+					ISteamNetworkingMessage* message = receiveBatch[i];
+					stats.readBytes += (size_t)message->GetSize();
 
-			stats.readBytes += (size_t)message->GetSize();
+					handleMessage(message->m_conn, message->GetData(), (u32)message->GetSize());
 
-			des.object(header);
-			if(networkInterface->_internalOnMessageRecieved(message->m_conn, header, des))
-				networkInterface->onMessageRecieved(message->m_conn, header, des);
-			
-			if(!endDeserialize(des)) {
-				log(ERROR_SEVERITY_WARNING, "Deserialization failed: (bitsery::ReaderError)%i\n", (int)des.adapter().error());
-				connectionAddWarning(message->m_conn);
+					message->Release(); // No need for this message anymore
+				}
 			}
-
-			message->Release(); // No need for this message anymore
 		}
 
 		networkInterface->_internalUpdate();
 		networkInterface->update();
 	}
 
+	/*
+	 * Runs GameNetworkingSockets' callbacks and receives messages on a thread of its own, so network I/O
+	 * doesn't compete with rendering and the simulation. Received messages, with their header already read,
+	 * and connection changes are queued in the order they happened and handled at the start of the next
+	 * tick, see beginTick(). Everything else, including sending, stays on the main thread.
+	 * 
+	 * @param pollInterval how long the thread sleeps when there is nothing to receive
+	 */
+	void startNetworkThread(std::chrono::microseconds pollInterval = defaultPollInterval) {
+		if(hasNetworkThread())
+			return;
+
+		networkThreadPollInterval = pollInterval;
+		networkThreadRunning.store(true, std::memory_order_release);
+		networkThread = std::thread([this]() { networkThreadLoop(); });
+	}
+
+	/* Joins the network thread and handles what it queued, messages are received on the main thread again */
+	void stopNetworkThread() {
+		if(!hasNetworkThread())
+			return;
+
+		networkThreadRunning.store(false, std::memory_order_release);
+		networkThread.join();
+
+		// nothing pushes anymore, so what did not fit into the queue follows it in order
+		drainNetworkEvents();
+		for(const NetworkEvent& event : pendingNetworkEvents)
+			handleNetworkEvent(event);
+		pendingNetworkEvents.clear();
+	}
+
+	NODISCARD bool hasNetworkThread() const {
+		return networkThread.joinable();
+	}
+
 	bool open(const SteamNetworkingIPAddr& addr) {
 		if(!networkInterface)
 			log(ERROR_SEVERITY_FATAL, "Before using NetworkManager::open(), the network interface must be set\n");
@@ -509,6 +857,9 @@ public:
 		if(!hasNetworkInterface())
 			return;
 
+		if(hasNetworkThread())
+			drainNetworkEvents();
+
 		networkInterface->beginTick();
 	}
 
@@ -528,6 +879,21 @@ public:
 		}
 	}
 
+	// Closes a connection that can't be served, the interface is told it left
+	void disconnect(HSteamNetConnection conn) {
+		if (connections.find(conn) != connections.end())
+			onConnectionLeave(conn);
+	}
+
+	/* The rate GameNetworkingSockets estimates it can send to conn at in bytes per second, 0 if unknown */
+	NODISCARD size_t getSendRate(HSteamNetConnection conn) const {
+		SteamNetConnectionRealTimeStatus_t status;
+		if (impl::getSockets()->GetConnectionRealTimeStatus(conn, &status, 0, nullptr) != k_EResultOK)
+			return 0;
+
+		return (size_t)std::max(0, status.m_nSendRateBytesPerSecond);
+	}
+
 	NODISCARD size_t getWrittenByteCount() const {
 		return stats.writtenBytes;
 	}
@@ -536,72 +902,457 @@ public:
 		return stats.readBytes;
 	}
 
-	/* resets read byte count and written byte count to zero. */
+	/* resets read byte count, written byte count and the compression stats to zero. */
 	void clearStats() {
 		stats.readBytes = 0;
 		stats.writtenBytes = 0;
+		compressionStats = CompressionStats();
+	}
+
+	/*
+	 * Compresses messages of at least minSize bytes sent to connections that joined after
+	 * compression was enabled on both ends. Peers announce it with MESSAGE_HEADER_COMPRESSION_OFFER
+	 * when connecting, so this must be called before NetworkManager::open().
+	 * 
+	 * dictionary is only used for a connection if the peer has the same one, see CompressionDictionary.
+	 */
+	void enableCompression(CompressionDictionary dictionary = CompressionDictionary(), size_t minSize = 64) {
+		compression.enabled = true;
+		compression.dictionary = std::move(dictionary);
+		compression.minSize = minSize;
+	}
+
+	void disableCompression() {
+		compression.enabled = false;
+		for (auto& pair : connections)
+			pair.second.compression = COMPRESSION_NONE;
+	}
+
+	NODISCARD bool isCompressing(HSteamNetConnection conn) const {
+		auto it = connections.find(conn);
+		return it != connections.end() && it->second.compression != COMPRESSION_NONE;
+	}
+
+	/*
+	 * Keeps the first maxSamples uncompressed messages of at least minSize bytes that are sent.
+	 * Feed them to CompressionDictionary::train() to build a dictionary for your game's traffic.
+	 */
+	void recordCompressionSamples(size_t maxSamples) {
+		compression.maxSamples = maxSamples;
 	}
 
+	NODISCARD const std::vector<std::vector<u8>>& getCompressionSamples() const { return compression.samples; }
+
+	struct CompressionStats {
+		size_t messagesCompressed = 0;
+		size_t bytesBeforeCompression = 0;
+		size_t bytesAfterCompression = 0;
+		u64 compressNanoseconds = 0;
+		size_t messagesDecompressed = 0;
+		size_t bytesDecompressed = 0;
+		u64 decompressNanoseconds = 0;
+	};
+
+	/* How much compression saved, and how long it took, since the last clearStats() */
+	NODISCARD const CompressionStats& getCompressionStats() const { return compressionStats; }
+
 protected:
 	struct Stats {
 		size_t writtenBytes = 0;
 		size_t readBytes = 0;
 	} stats;
 
+	CompressionStats compressionStats;
+
+	enum CompressionMode : u8 {
+		COMPRESSION_NONE = 0,
+		COMPRESSION_LZ,
+		COMPRESSION_LZ_DICTIONARY
+	};
+
+	enum CompressedFlags : u8 {
+		COMPRESSED_WITH_DICTIONARY = 1 << 0
+	};
+
+	// anything claiming to be bigger than this is malformed
+	static constexpr u32 maxDecompressedSize = 4 * 1024 * 1024;
+
 protected:
-	static void handleConnectionChange(SteamNetConnectionStatusChangedCallback_t* info) {
-		NetworkManager& manager = getNetworkManager();
+	void handleMessage(HSteamNetConnection conn, const void* data, u32 size, bool allowCompressed = true) {
+		Deserializer des = startDeserialize(size, data);
+		MessageHeader header = MESSAGE_HEADER_INVALID;
 
-		switch (info->m_info.m_eState)
-		{
-		case k_ESteamNetworkingConnectionState_None:
-			break;
+		des.object(header);
+		dispatchMessage(conn, header, des, (const u8*)data, allowCompressed);
+	}
 
-		case k_ESteamNetworkingConnectionState_ClosedByPeer:
-		case k_ESteamNetworkingConnectionState_ProblemDetectedLocally:
-			manager.onConnectionLeave(info->m_hConn);
-			break;
+	/* body is the message after its header, which the network thread already read */
+	void handleMessage(HSteamNetConnection conn, MessageHeader header, const u8* body, u32 bodySize) {
+		Deserializer des = startDeserialize(bodySize, body);
+		dispatchMessage(conn, header, des, body, true);
+	}
 
-		case k_ESteamNetworkingConnectionState_Connecting:
-			manager.onConnectionIncoming(info->m_hConn);
-			break;
+	// des reads from data
+	void dispatchMessage(HSteamNetConnection conn, MessageHeader header, Deserializer& des, const u8* data, bool allowCompressed) {
+		switch (header) {
+		case MESSAGE_HEADER_COMPRESSED:
+			if (!allowCompressed) {
+				des.adapter().error(bitsery::ReaderError::InvalidData);
+				break;
+			}
 
-		case k_ESteamNetworkingConnectionState_Connected:
-			manager.onConnectionJoin(info->m_hConn);
+			handleCompressedMessage(conn, data, des);
 			break;
 
-		default:
-			break;
+		case MESSAGE_HEADER_COMPRESSION_OFFER: {
+			u64 dictionaryHash = 0;
+			des.object(dictionaryHash);
+
+			auto it = connections.find(conn);
+			if (compression.enabled && it != connections.end()) {
+				const bool sameDictionary = !compression.dictionary.empty() && dictionaryHash == compression.dictionary.getHash();
+				it->second.compression = sameDictionary ? COMPRESSION_LZ_DICTIONARY : COMPRESSION_LZ;
+			}
+		} break;
+
+		default: {
+			auto handler = messageHandlers.find(header);
+			if(handler != messageHandlers.end())
+				handler->second(conn, des);
+			else if(networkInterface->_internalOnMessageRecieved(conn, header, des))
+				networkInterface->onMessageRecieved(conn, header, des);
+		} break;
+		}
+
+		if(!endDeserialize(des)) {
+			log(ERROR_SEVERITY_WARNING, "Deserialization failed: (bitsery::ReaderError)%i\n", (int)des.adapter().error());
+			connectionAddWarning(conn);
 		}
 	}
 
-	void onConnectionIncoming(HSteamNetConnection conn) {
-		if(!networkInterface->shouldAcceptConnection(conn))
+	void handleCompressedMessage(HSteamNetConnection conn, const u8* data, Deserializer& des) {
+		u8 flags = 0;
+		u32 decompressedSize = 0;
+		des.value1b(flags);
+		des.ext4b(decompressedSize, bitsery::ext::CompactValue{});
+
+		InputAdapter& adapter = des.adapter();
+		if (adapter.error() != bitsery::ReaderError::NoError)
 			return;
 
-		connections.insert(std::pair(conn, ConnectionData{}));
+		const bool withDictionary = flags & COMPRESSED_WITH_DICTIONARY;
+		if (decompressedSize > maxDecompressedSize || (withDictionary && compression.dictionary.empty())) {
+			adapter.error(bitsery::ReaderError::InvalidData);
+			return;
+		}
 
-		networkInterface->acceptConnection(conn);
+		// the rest of the message is the compressed payload
+		const u8* payload = data + adapter.currentReadPos();
+		const size_t payloadSize = adapter.currentReadEndPos() - adapter.currentReadPos();
+		adapter.currentReadPos(adapter.currentReadEndPos());
+
+		auto start = std::chrono::steady_clock::now();
+		bool decompressed = compression.codec.decompress(payload, payloadSize, decompressedSize, compression.scratch, withDictionary ? &compression.dictionary : nullptr);
+		compressionStats.decompressNanoseconds += (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+		if (!decompressed) {
+			adapter.error(bitsery::ReaderError::InvalidData);
+			return;
+		}
+
+		compressionStats.messagesDecompressed++;
+		compressionStats.bytesDecompressed += decompressedSize;
+
+		handleMessage(conn, compression.scratch.data(), decompressedSize, false);
 	}
 
-	void onConnectionJoin(HSteamNetConnection conn) {
-		impl::getSockets()->SetConnectionPollGroup(conn, pollGroup);
-		
-		networkInterface->_internalOnConnectionJoin(conn);
-		networkInterface->onConnectionJoin(conn);
+	/*
+	 * Fills compressed with messageBuffer wrapped in a MESSAGE_HEADER_COMPRESSED message.
+	 * Returns false if it should be sent as is, messages bigger than maxDecompressedSize always are
+	 * since the receiver would reject them.
+	 */
+	bool tryCompress(const MessageBuffer& messageBuffer, CompressionMode mode, MessageBuffer& compressed) {
+		if (mode == COMPRESSION_NONE || messageBuffer.getSize() < compression.minSize || messageBuffer.getSize() > maxDecompressedSize)
+			return false;
+
+		const bool withDictionary = mode == COMPRESSION_LZ_DICTIONARY;
+
+		auto start = std::chrono::steady_clock::now();
+		bool smaller = compression.codec.compress(messageBuffer.getData(), messageBuffer.getSize(), compression.compressed, withDictionary ? &compression.dictionary : nullptr);
+		compressionStats.compressNanoseconds += (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+		if (!smaller)
+			return false;
+
+		compressed.clear();
+		Serializer ser = startSerialize(compressed);
+		ser.object(MESSAGE_HEADER_COMPRESSED);
+		ser.value1b((u8)(withDictionary ? COMPRESSED_WITH_DICTIONARY : 0));
+		ser.ext4b((u32)messageBuffer.getSize(), bitsery::ext::CompactValue{});
+		endSerialize(ser, compressed);
+
+		const size_t headerSize = compressed.getSize();
+		compressed.addSize(compression.compressed.size());
+		memcpy(compressed.getData() + headerSize, compression.compressed.data(), compression.compressed.size());
+
+		compressionStats.messagesCompressed++;
+		compressionStats.bytesBeforeCompression += messageBuffer.getSize();
+		compressionStats.bytesAfterCompression += compressed.getSize();
+		return true;
 	}
 
-	void onConnectionLeave(HSteamNetConnection conn) {
-		networkInterface->onConnectionLeave(conn);
-		networkInterface->closeConnection(conn);
-		connections.erase(conn);
+	void recordCompressionSample(const MessageBuffer& messageBuffer) {
+		if (compression.samples.size() < compression.maxSamples && messageBuffer.getSize() >= compression.minSize)
+			compression.samples.emplace_back(messageBuffer.getData(), messageBuffer.getData() + messageBuffer.getSize());
 	}
 
 protected:
-	static constexpr u32 maxWarnings = 5;
+	static int getSendFlags(bool sendReliable) {
+		if(sendReliable)
+			return k_nSteamNetworkingSend_Reliable | k_nSteamNetworkingSend_AutoRestartBrokenSession;
+		else
+			return k_nSteamNetworkingSend_Unreliable;
+	}
 
-	struct ConnectionData {
-		// Connections have "warnings."
+	/* Compresses the message once for each compression mode used by targets, then shares it between them */
+	EResult sendToConnections(const std::vector<HSteamNetConnection>& targets, MessageBuffer&& messageBuffer_, int steamMessageFlags) {
+		MessageBuffer messageBuffer = std::move(messageBuffer_);
+
+		recordCompressionSample(messageBuffer);
+		if (!compression.enabled)
+			return sendShared(targets, std::move(messageBuffer), steamMessageFlags);
+
+		for (auto& group : compressionGroups)
+			group.clear();
+		for (HSteamNetConnection target : targets)
+			compressionGroups[connections[target].compression].push_back(target);
+
+		EResult result = k_EResultOK;
+		for (u8 mode : { COMPRESSION_LZ, COMPRESSION_LZ_DICTIONARY }) {
+			std::vector<HSteamNetConnection>& group = compressionGroups[mode];
+			if (group.empty())
+				continue;
+
+			if (!tryCompress(messageBuffer, (CompressionMode)mode, compressedBuffer)) {
+				compressionGroups[COMPRESSION_NONE].insert(compressionGroups[COMPRESSION_NONE].end(), group.begin(), group.end());
+				continue;
+			}
+
+			EResult groupResult = sendShared(group, std::move(compressedBuffer), steamMessageFlags);
+			if (groupResult != k_EResultOK)
+				result = groupResult;
+		}
+
+		EResult rawResult = sendShared(compressionGroups[COMPRESSION_NONE], std::move(messageBuffer), steamMessageFlags);
+		return rawResult != k_EResultOK ? rawResult : result;
+	}
+
+	EResult sendShared(const std::vector<HSteamNetConnection>& targets, MessageBuffer&& messageBuffer_, int steamMessageFlags) {
+		MessageBuffer messageBuffer = std::move(messageBuffer_);
+
+		if(targets.empty())
+			return k_EResultOK;
+
+		stats.writtenBytes += messageBuffer.getSize();
+
+		// every message holds a reference to the buffer's block, the last one freed
+		// returns it to the pool, so the data is shared instead of copied per connection
+		impl::getMessageBufferPool().addReferences(messageBuffer.getData(), (u32)targets.size());
+
+		for (HSteamNetConnection target : targets) {
+			networkingMessages.push_back(impl::getUtils()->AllocateMessage(0));
+			ISteamNetworkingMessage& message = *networkingMessages.back();
+
+			message.m_conn = target;
+			message.m_cbSize = (int)messageBuffer.getSize();
+			message.m_pData = (void*)messageBuffer.getData();
+			message.m_nFlags = steamMessageFlags;
+
+			message.m_pfnFreeData = 
+				[](ISteamNetworkingMessage* message){
+					impl::getMessageBufferPool().release((u8*)message->m_pData);
+				};
+		}
+
+		std::vector<int64_t>& results = sendResults;
+		results.resize(networkingMessages.size());
+
+		impl::getSockets()->SendMessages((int)networkingMessages.size(), networkingMessages.data(), (int64*)results.data());
+		networkingMessages.clear();
+	
+		for(int64_t messageResult : results) {
+			if(messageResult < 0)
+				return (EResult)-messageResult;
+		}
+
+		return k_EResultOK;
+	}
+
+protected:
+	static void handleConnectionChange(SteamNetConnectionStatusChangedCallback_t* info) {
+		NetworkManager& manager = getNetworkManager();
+
+		// callbacks run on the thread calling RunCallbacks(), the change is handled with the messages
+		if (isNetworkThread()) {
+			NetworkEvent event;
+			event.conn = info->m_hConn;
+			event.state = info->m_info.m_eState;
+			manager.pendingNetworkEvents.push_back(event);
+			return;
+		}
+
+		manager.onConnectionStateChanged(info->m_hConn, info->m_info.m_eState);
+	}
+
+	void onConnectionStateChanged(HSteamNetConnection conn, ESteamNetworkingConnectionState state) {
+		switch (state)
+		{
+		case k_ESteamNetworkingConnectionState_None:
+			break;
+
+		case k_ESteamNetworkingConnectionState_ClosedByPeer:
+		case k_ESteamNetworkingConnectionState_ProblemDetectedLocally:
+			onConnectionLeave(conn);
+			break;
+
+		case k_ESteamNetworkingConnectionState_Connecting:
+			onConnectionIncoming(conn);
+			break;
+
+		case k_ESteamNetworkingConnectionState_Connected:
+			onConnectionJoin(conn);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	void onConnectionIncoming(HSteamNetConnection conn) {
+		if(!networkInterface->shouldAcceptConnection(conn))
+			return;
+
+		connections.insert(std::pair(conn, ConnectionData{}));
+
+		networkInterface->acceptConnection(conn);
+	}
+
+	void onConnectionJoin(HSteamNetConnection conn) {
+		impl::getSockets()->SetConnectionPollGroup(conn, pollGroup);
+
+		if (compression.enabled) {
+			MessageBuffer offer;
+			Serializer ser = startSerialize(offer);
+			ser.object(MESSAGE_HEADER_COMPRESSION_OFFER);
+			ser.object(compression.dictionary.getHash());
+			endSerialize(ser, offer);
+
+			sendMessage(conn, std::move(offer), false, true);
+		}
+		
+		networkInterface->_internalOnConnectionJoin(conn);
+		networkInterface->onConnectionJoin(conn);
+	}
+
+	void onConnectionLeave(HSteamNetConnection conn) {
+		networkInterface->onConnectionLeave(conn);
+		networkInterface->_internalOnConnectionLeave(conn);
+		networkInterface->closeConnection(conn);
+		connections.erase(conn);
+	}
+
+protected:
+	/* A received message or, if message is nullptr, a connection change, see startNetworkThread() */
+	struct NetworkEvent {
+		ISteamNetworkingMessage* message = nullptr;
+		MessageHeader header = MESSAGE_HEADER_INVALID;
+		HSteamNetConnection conn = k_HSteamNetConnection_Invalid;
+		ESteamNetworkingConnectionState state = k_ESteamNetworkingConnectionState_None;
+	};
+
+	static bool& isNetworkThread() {
+		static thread_local bool networkThread = false;
+		return networkThread;
+	}
+
+	void networkThreadLoop() {
+		isNetworkThread() = true;
+		std::array<ISteamNetworkingMessage*, receiveBatchSize> batch;
+
+		while (networkThreadRunning.load(std::memory_order_acquire)) {
+			impl::getSockets()->RunCallbacks(); // connection changes land in pendingNetworkEvents
+
+			// messages are left with GameNetworkingSockets while the main thread is behind
+			int count = 0;
+			if (flushNetworkEvents()) {
+				count = impl::getSockets()->ReceiveMessagesOnPollGroup(pollGroup, batch.data(), (int)batch.size());
+				for (int i = 0; i < count; i++) {
+					NetworkEvent event;
+					event.message = batch[i];
+					event.conn = batch[i]->m_conn;
+					event.header = batch[i]->GetSize() > 0 ? (MessageHeader)((const u8*)batch[i]->GetData())[0] : MESSAGE_HEADER_INVALID;
+					pendingNetworkEvents.push_back(event);
+				}
+
+				flushNetworkEvents();
+			}
+
+			// a full batch means there is probably more waiting
+			if (count < (int)batch.size())
+				std::this_thread::sleep_for(networkThreadPollInterval);
+		}
+	}
+
+	// network thread side, moves what fits into the queue. True if nothing is left pending
+	bool flushNetworkEvents() {
+		size_t pushed = 0;
+		while (pushed < pendingNetworkEvents.size() && networkEvents.push(pendingNetworkEvents[pushed]))
+			pushed++;
+
+		pendingNetworkEvents.erase(pendingNetworkEvents.begin(), pendingNetworkEvents.begin() + pushed);
+		return pendingNetworkEvents.empty();
+	}
+
+	void drainNetworkEvents() {
+		NetworkEvent event;
+		while (networkEvents.pop(event))
+			handleNetworkEvent(event);
+	}
+
+	void handleNetworkEvent(const NetworkEvent& event) {
+		if (!networkInterface) {
+			if (event.message)
+				event.message->Release();
+			return;
+		}
+
+		if (!event.message) {
+			onConnectionStateChanged(event.conn, event.state);
+			return;
+		}
+
+		ISteamNetworkingMessage* message = event.message;
+		const u32 size = (u32)message->GetSize();
+		stats.readBytes += size;
+
+		// the connection may have been closed while the message waited in the queue
+		if (connections.find(event.conn) != connections.end()) {
+			if (size == 0)
+				connectionAddWarning(event.conn);
+			else
+				handleMessage(event.conn, event.header, (const u8*)message->GetData() + 1, size - 1);
+		}
+
+		message->Release();
+	}
+
+	static constexpr u32 maxWarnings = 5;
+	static constexpr size_t receiveBatchSize = 64;
+	static constexpr size_t networkEventQueueSize = 4096;
+	static constexpr std::chrono::microseconds defaultPollInterval = std::chrono::microseconds(1000);
+
+	struct ConnectionData {
+		// Connections have "warnings."
 		// If the connection were to assume some suspicous behaviour i.e. any of the following:
 		//	- Sending malformed messages
 		//  - Attempting to impersonate another connection
@@ -609,12 +1360,40 @@ protected:
 		//  it will recieve a warning.
 		// If a connection exceeds the maxWarnings, it will be forcibly disconnected.
 		u32 warnings = 0; 
+
+		// set once the peer offers compression, see enableCompression()
+		CompressionMode compression = COMPRESSION_NONE;
 	};
 
+	struct {
+		bool enabled = false;
+		size_t minSize = 64;
+		CompressionDictionary dictionary;
+		MessageCodec codec;
+		std::vector<u8> compressed;
+		std::vector<u8> scratch; // decompressed messages
+
+		size_t maxSamples = 0;
+		std::vector<std::vector<u8>> samples;
+	} compression;
+
 	HSteamNetPollGroup pollGroup;
+	std::array<ISteamNetworkingMessage*, receiveBatchSize> receiveBatch;
 	std::vector<ISteamNetworkingMessage*> networkingMessages;
+	std::vector<int64_t> sendResults; // of networkingMessages
+	std::vector<HSteamNetConnection> sendTargets;
+	std::array<std::vector<HSteamNetConnection>, 3> compressionGroups; // by CompressionMode
+	MessageBuffer compressedBuffer;
 	std::unordered_map<HSteamNetConnection, ConnectionData> connections;
+	impl::FastMap<MessageHeader, MessageHandler> messageHandlers;
 	std::shared_ptr<NetworkInterface> networkInterface;
+
+	// see startNetworkThread()
+	std::thread networkThread;
+	std::atomic<bool> networkThreadRunning{ false };
+	std::chrono::microseconds networkThreadPollInterval = defaultPollInterval;
+	impl::SpscQueue<NetworkEvent> networkEvents{ networkEventQueueSize };
+	std::vector<NetworkEvent> pendingNetworkEvents; // network thread side, what did not fit into networkEvents yet
 };
 
 /* Network Syncing */
@@ -622,11 +1401,11 @@ protected:
 struct NetworkedEntity {};
 struct NetworkedComponent {};
 
+// Every update is resent until the client acknowledges a snapshot containing it,
+// so both piorities are ensured to reach connected clients eventually.
 enum class ComponentPiority {
-	// Connected clients are ensured to recieve the updates of this component
+	// Serialized first in every snapshot
 	High,
-	// Connected clients are NOT ensured to recieve the updates of this component. 
-	// Component update could be lost due to packet loss.
 	Low 
 };
 
@@ -655,7 +1434,247 @@ namespace impl {
 		PHYSICS_SNAPSHOT = 1 << 1,
 		META_DATA_SNAPSHOT = 1 << 2,
 		COMPONENT_UPDATE_SNAPSHOT = 1 << 3,
-		LOW_PIORITY = 1 << 4 // Does this snapshot contain low piority data?
+		LOW_PIORITY = 1 << 4 // Does this snapshot contain low piority component updates?
+	};
+
+	/*
+	 * Maps raw or network entity ids to T without allocating per insert, for the change tracking that runs on every
+	 * component write. Values live in fixed size pages indexed by the id, a page is allocated the first
+	 * time an id in it is used and kept from then on. The ids in use are listed next to them, so clear()
+	 * only touches what was used. Iteration is in ascending id order.
+	 */
+	template<typename T>
+	class EntityTable {
+	public:
+		static constexpr u32 pageSize = 1024;
+
+		T& operator[](u32 id) {
+			Slot& slot = getSlot(id);
+			if (!slot.present) {
+				slot.present = true;
+				count++;
+
+				if (!slot.listed) {
+					slot.listed = true;
+					unsorted |= !ids.empty() && ids.back() > id;
+					ids.push_back(id);
+				}
+			}
+
+			return slot.value;
+		}
+
+		void insert(u32 id) { (*this)[id]; }
+
+		NODISCARD T* find(u32 id) {
+			Slot* slot = findSlot(id);
+			return slot && slot->present ? &slot->value : nullptr;
+		}
+
+		NODISCARD const T* find(u32 id) const {
+			const Slot* slot = findSlot(id);
+			return slot && slot->present ? &slot->value : nullptr;
+		}
+
+		NODISCARD bool contains(u32 id) const { return find(id) != nullptr; }
+
+		// the id stays listed until the next iteration, so erasing while iterating is fine
+		void erase(u32 id) {
+			Slot* slot = findSlot(id);
+			if (!slot || !slot->present)
+				return;
+
+			slot->present = false;
+			slot->value = T();
+			count--;
+			erased = true;
+		}
+
+		void clear() {
+			for (u32 id : ids)
+				*findSlot(id) = Slot();
+
+			ids.clear();
+			count = 0;
+			unsorted = false;
+			erased = false;
+		}
+
+		NODISCARD size_t size() const { return count; }
+		NODISCARD bool empty() const { return count == 0; }
+
+		/* The ids in use, in ascending order */
+		NODISCARD const std::vector<u32>& getIds() const {
+			normalize();
+			return ids;
+		}
+
+		/* Calls f(id, value) for every id in use, in ascending order */
+		template<typename F>
+		void forEach(F&& f) {
+			normalize();
+			for (size_t i = 0; i < ids.size(); i++) {
+				Slot& slot = *findSlot(ids[i]);
+				if (slot.present)
+					f(ids[i], slot.value);
+			}
+		}
+
+		template<typename F>
+		void forEach(F&& f) const {
+			normalize();
+			for (u32 id : ids)
+				f(id, (const T&)findSlot(id)->value);
+		}
+
+		/*
+		 * The listed ids are brought in order lazily, most changes are recorded in ascending order anyway.
+		 * Iterating does it on demand, so a table read by several threads at once has to be normalized first.
+		 */
+		void normalize() const {
+			if (erased) {
+				ids.erase(std::remove_if(ids.begin(), ids.end(), [&](u32 id) {
+					Slot& slot = *findSlot(id);
+					slot.listed = slot.present;
+					return !slot.present;
+				}), ids.end());
+				erased = false;
+			}
+
+			if (unsorted) {
+				std::sort(ids.begin(), ids.end());
+				unsorted = false;
+			}
+		}
+
+	private:
+		struct Slot {
+			T value = T();
+			bool present = false;
+			bool listed = false; // in ids, erased slots stay listed until normalize()
+		};
+
+		Slot& getSlot(u32 id) {
+			const size_t page = id / pageSize;
+			if (page >= pages.size())
+				pages.resize(page + 1);
+			if (!pages[page])
+				pages[page] = std::make_unique<Slot[]>(pageSize);
+
+			return pages[page][id % pageSize];
+		}
+
+		Slot* findSlot(u32 id) const {
+			const size_t page = id / pageSize;
+			return page < pages.size() && pages[page] ? &pages[page][id % pageSize] : nullptr;
+		}
+
+		std::vector<std::unique_ptr<Slot[]>> pages;
+		mutable std::vector<u32> ids;
+		mutable bool unsorted = false;
+		mutable bool erased = false;
+		size_t count = 0;
+	};
+
+	/*
+	 * Maps networked entities to the network ids snapshots refer to them by, and back. The server allocates
+	 * the ids densely from 1, so they take one or two bytes on the wire whatever the entity ids are. Clients
+	 * bind the ids they receive to entities of their own, which can be any entity ids.
+	 *
+	 * Slots hold the whole entity id, generation included, so a slot of a dead entity resolves to nothing.
+	 * Ids have generations of their own, see getGeneration().
+	 */
+	class NetIdTable {
+	public:
+		static constexpr u32 invalid = 0;
+		static constexpr u32 maxNetId = (1 << 24) - 1; // anything above is malformed
+
+		/* The network id of entity, invalid if it has none */
+		NODISCARD u32 find(flecs::entity entity) const {
+			const u32* netId = byEntity.find(cf<u32>(entity.id()));
+			return netId && entities[*netId] == entity.id() ? *netId : invalid;
+		}
+
+		/*
+		 * Bumped whenever the server releases netId. Snapshots send it with every entity that is new to
+		 * a client, so the client can tell a reused id from one it already has, see spawnNetEntity().
+		 */
+		NODISCARD u8 getGeneration(u32 netId) const {
+			return netId < generations.size() ? generations[netId] : 0;
+		}
+
+		/* Client side, what the server said netId's generation is. netId must be bound */
+		void setGeneration(u32 netId, u8 generation) {
+			generations[netId] = generation;
+		}
+
+		/* The entity bound to netId, a null entity if there is none or it died */
+		NODISCARD flecs::entity getEntity(u32 netId) const {
+			if (netId >= entities.size() || !entities[netId] || !getEntityWorld().is_alive(entities[netId]))
+				return flecs::entity();
+
+			return getEntityWorld().get_alive(entities[netId]);
+		}
+
+		void bind(u32 netId, flecs::entity entity) {
+			assert(netId != invalid && netId <= maxNetId);
+			if (netId >= entities.size()) {
+				entities.resize(netId + 1, 0);
+				generations.resize(netId + 1, 0);
+			}
+
+			entities[netId] = entity.id();
+			byEntity[cf<u32>(entity.id())] = netId;
+		}
+
+		void unbind(u32 netId) {
+			if (netId >= entities.size() || !entities[netId])
+				return;
+
+			u32* bound = byEntity.find(cf<u32>(entities[netId]));
+			if (bound && *bound == netId)
+				byEntity.erase(cf<u32>(entities[netId]));
+			entities[netId] = 0;
+		}
+
+		/*
+		 * Server side, binds entity to a free id. An id is only reused once delay snapshots were sealed after
+		 * the one its release was recorded in, so no delta a client can still be sent mentions both entities.
+		 */
+		u32 allocate(flecs::entity entity, u32 sealedSequence, u32 delay) {
+			u32 netId;
+			if (!released.empty() && sealedSequence >= released.front().second + delay) {
+				netId = released.front().first;
+				released.pop_front();
+			} else {
+				netId = std::max((u32)entities.size(), 1u);
+				if (netId > maxNetId)
+					log(ERROR_SEVERITY_FATAL, "More than %u networked entities\n", maxNetId);
+			}
+
+			bind(netId, entity);
+			return netId;
+		}
+
+		/* Server side, frees netId, sequence is the snapshot its release is recorded in */
+		void release(u32 netId, u32 sequence) {
+			unbind(netId);
+			generations[netId]++;
+			released.push_back({ netId, sequence });
+		}
+
+		void clear() {
+			byEntity.clear();
+			entities.clear();
+			generations.clear();
+			released.clear();
+		}
+
+	private:
+		EntityTable<u32> byEntity; // by raw entity id
+		std::vector<flecs::entity_t> entities; // by network id, 0 if unbound
+		std::vector<u8> generations; // by network id
+		std::deque<std::pair<u32, u32>> released; // network ids and the snapshots they were released in, oldest first
 	};
 }
 
@@ -664,6 +1683,82 @@ void serialize(S& s, impl::SnapshotFlags& flags) {
 	s.value1b(flags);
 }
 
+/*
+ * How TransformComponent and IntegratableComponent are quantized in snapshots.
+ * Values are written as fixed point numbers of the given bit counts, values that do not fit their range
+ * fall back to full floats behind a flag bit. The server and its clients must use the same settings.
+ */
+struct QuantizationSettings {
+	bool enabled = true;
+
+	// positions are fixed point relative to these bounds, the physics world's wrap bounds are used instead if it wraps
+	AABB positionBounds = AABB(4096.0f, 4096.0f);
+	u8 positionBits = 20;
+	float maxOrigin = 256.0f; // origins are relative to the position, so they get a much smaller range
+	u8 originBits = 14;
+	u8 angleBits = 14;
+	float maxLinearVelocity = 2048.0f;
+	u8 linearVelocityBits = 16;
+	float maxAngularVelocity = 64.0f;
+	u8 angularVelocityBits = 12;
+};
+
+/*
+ * How the entities competing for a client's byte budget are ordered, see ServerInterface::setClientBandwidth().
+ * Every snapshot an entity with changes is left out of adds its weight to its priority, so even the
+ * least important entities are eventually sent.
+ */
+struct PrioritySettings {
+	float highPiorityWeight = 4.0f; // ComponentPiority::High changes
+	float lowPiorityWeight = 1.0f; // ComponentPiority::Low changes
+	float enterWeight = 2.0f; // multiplier for entities coming into view
+	// an entity distance away from the view entity weighs viewRadius / (viewRadius + distance * distanceFalloff)
+	float distanceFalloff = 1.0f;
+	float worldViewRadius = 1000.0f; // the viewRadius of the above for views that see the whole world
+	// once one does not fit the budget, this many more candidates are measured to fill what is left of it
+	size_t fillCandidates = 16;
+};
+
+namespace impl {
+	template<typename S>
+	struct IsDeserializer : std::false_type {};
+
+	template<typename Adapter, typename Context>
+	struct IsDeserializer<::bitsery::Deserializer<Adapter, Context>> : std::true_type {};
+
+	/* 
+	 * Serializes value as a bits wide fixed point number in [min, max]. Values outside of it (and NaNs) are
+	 * written as plain floats instead. Must be called on a bit packing enabled serializer.
+	 */
+	template<typename S>
+	void serializeRanged(S& s, float& value, float min, float max, u8 bits) {
+		float copy = value; // the serializer must not modify the component it reads from
+		bool raw = !(copy >= min && copy <= max);
+
+		s.boolValue(raw);
+		if (raw)
+			s.value4b(copy);
+		else
+			s.ext(copy, ::bitsery::ext::ValueRange<float>(min, max, ::bitsery::ext::BitsConstraint(bits)));
+
+		if constexpr (IsDeserializer<S>::value)
+			value = copy;
+	}
+
+	/* Angles are wrapped into [-pi, pi] before being written, so the receiver may get rot +- 2pi*k */
+	template<typename S>
+	void serializeAngle(S& s, float& angle, u8 bits) {
+		constexpr float pi = 3.14159265f;
+
+		float copy = angle - 2.0f * pi * std::floor((angle + pi) / (2.0f * pi));
+		copy = std::clamp(copy, -pi, pi); // rounding can land just outside
+		s.ext(copy, ::bitsery::ext::ValueRange<float>(-pi, pi, ::bitsery::ext::BitsConstraint(bits)));
+
+		if constexpr (IsDeserializer<S>::value)
+			angle = copy;
+	}
+}
+
 class NetworkStateManager;
 
 NetworkStateManager& getNetworkStateManager();
@@ -674,39 +1769,76 @@ NetworkStateManager& getNetworkStateManager();
  * used for deserilizing these snapshots client side.
  */
 class NetworkStateManager {
+	friend struct NetworkStateManagerTest; // reaches the snapshot internals, see src/tests
+
+public:
+	// 1.6 seconds at the default 20 network updates per second
+	static constexpr u32 defaultSnapshotHistoryLength = 32;
+
+	// network ids in ascending order, what a client can see, see findRelevantEntities()
+	using EntityIdList = std::vector<u32>;
+
+private:
 	using ListSize = u32;
 	using CompId = u32;
-	using EntityId = u32;
+	using EntityId = u32; // a network id, see getNetId()
 	using PhysicsId = u32;
-	template<typename T>
-	using Set = std::set<T>;
 	template<typename K, typename T>
 	using Map = impl::FastMap<K, T>;
+	template<typename T>
+	using EntityTable = impl::EntityTable<T>;
+	using EntitySet = impl::EntityTable<bool>;
+
+	// bit i is the component with ComponentInfo::index i
+	using ComponentMask = u64;
+	static constexpr size_t maxComponents = 64;
+
+	struct MergedSnapshot;
+	struct Candidate;
 
 public:
+	class SnapshotEncoder;
+
 	NetworkStateManager() {
 		auto& world = getEntityWorld();
 		
-		registerComponent<NetworkedEntity>();
-		world.add<NetworkedEntity>();
+		// components added before NetworkedEntity were not recorded, so the whole entity is
+		flecs::entity addObserver = world.observer()
+			.term<NetworkedEntity>()
+			.event(flecs::OnAdd)
+			.each([this](flecs::entity e) {
+				if(!assignsNetIds || netIds.find(e))
+					return;
+
+				recordWholeEntity(netIds.allocate(e, sequence, (u32)snapshotHistory.size()), e);
+			});
 
 		flecs::entity removeObserver = world.observer()
 			.term<NetworkedEntity>()
 			.event(flecs::OnRemove)
 			.each([this](flecs::entity e) {
-				deltaSnapshot.resetEntity(impl::cf<EntityId>(e));
-				deltaSnapshot.metaData.removeEntities.insert(impl::cf<EntityId>(e));
-				deltaSnapshot.metaData.currentGens[e].second = true;
+				EntityId id = getRecordedId(e);
+				if(!id)
+					return;
+
+				deltaSnapshot.resetEntity(id);
+				deltaSnapshot.metaData.removeEntities.insert(id);
+				netIds.release(id, sequence + 1);
 			});
 
+		allDeltaSnapshotSystems.push_back(addObserver);
 		allDeltaSnapshotSystems.push_back(removeObserver);
 
+		registerComponent<NetworkedEntity>();
+		world.add<NetworkedEntity>();
+
 		flecs::entity getAllBodiesSystem = 
 			world.system<ShapeComponent>()
 			.kind<NoPhase>()
 			.with<NetworkedEntity>()
-			.each([this](ShapeComponent& shapeId){
-				if(!shapeId.isValid())
+			.each([this](flecs::entity entity, ShapeComponent& shapeId){
+				EntityId id = netIds.find(entity);
+				if(!shapeId.isValid() || !id || !isInFilter(id))
 					return;
 
 				Shape& shape = getPhysicsWorld().getShape(shapeId.shape);
@@ -714,6 +1846,40 @@ public:
 			});
 
 		fullSnapshotSystems.push_back(getAllBodiesSystem);
+
+		shapelessQuery = world.query_builder()
+			.term<NetworkedEntity>()
+			.without<ShapeComponent>()
+			.term(flecs::Disabled).optional()
+			.build();
+
+		networkedQuery = world.query_builder()
+			.term<NetworkedEntity>()
+			.term(flecs::Disabled).optional()
+			.build();
+	}
+
+	NODISCARD const QuantizationSettings& getQuantizationSettings() const { return quantization; }
+	void setQuantizationSettings(const QuantizationSettings& settings) { quantization = settings; }
+
+	NODISCARD const PrioritySettings& getPrioritySettings() const { return priorities; }
+	void setPrioritySettings(const PrioritySettings& settings) { priorities = settings; }
+
+	/*
+	 * Client side, beforeApply is called right before a snapshot changes the world and afterApply
+	 * right after it did. Snapshots that are dropped call neither. Callbacks are called in the order
+	 * they were added. See InterpolationBuffer and Prediction.
+	 * 
+	 * @return an id for removeSnapshotApplyCallbacks()
+	 */
+	u32 addSnapshotApplyCallbacks(std::function<void()> beforeApply, std::function<void()> afterApply) {
+		applyCallbacks.push_back({ ++lastApplyCallbackId, std::move(beforeApply), std::move(afterApply) });
+		return lastApplyCallbackId;
+	}
+
+	void removeSnapshotApplyCallbacks(u32 id) {
+		applyCallbacks.erase(std::remove_if(applyCallbacks.begin(), applyCallbacks.end(),
+			[&](const ApplyCallbacks& callbacks) { return callbacks.id == id; }), applyCallbacks.end());
 	}
 
 	// lets us know that the user state has changed
@@ -729,6 +1895,9 @@ public:
 		for (flecs::entity system : fullSnapshotSystems) {
 			system.destruct();
 		}
+
+		shapelessQuery.destruct();
+		networkedQuery.destruct();
 	}
 
 	std::string getNetworkedEntityInfo() {
@@ -748,7 +1917,7 @@ public:
 
 
 		for(flecs::entity entity : entities) {
-			info += formatString("<bold>Entity %u %u<reset>\n", impl::cf<u32>(entity.id()), (u32)ECS_GENERATION(entity.id()));
+			info += formatString("<bold>Entity %u %u<reset> (net id %u)\n", impl::cf<u32>(entity.id()), (u32)ECS_GENERATION(entity.id()), netIds.find(entity));
 
 			entity.each([&](flecs::id comp) {
 				info += formatString("\t%s - %u\n", comp.str().c_str(), impl::cf<u32>(comp.raw_id()));
@@ -764,54 +1933,160 @@ public:
 
 	flecs::entity enable(flecs::entity e) {
 		e.enable();
-		deltaSnapshot.needActive(e, MetaDataSnapshot::DO_ENABLE);
+		if(EntityId id = getRecordedId(e))
+			deltaSnapshot.needActive(id, MetaDataSnapshot::DO_ENABLE);
 		return e;
 	}
 
 	flecs::entity disable(flecs::entity e) {
 		e.disable();
-		deltaSnapshot.needActive(e, MetaDataSnapshot::DO_DISABLE);
+		if(EntityId id = getRecordedId(e))
+			deltaSnapshot.needActive(id, MetaDataSnapshot::DO_DISABLE);
 		return e;
 	}
 
-	template<typename ComponentType>
-	void registerComponent(ComponentPiority piority = ComponentPiority::Low) {
-		auto& entityWorld = getEntityWorld();
-
+	/*
+	 * The id snapshots refer to a networked entity by, the same on the server and its clients, 0 if entity
+	 * has none. Components that hold entities should send these instead of entity ids, which differ.
+	 */
+	NODISCARD u32 getNetId(flecs::entity entity) const { return netIds.find(entity); }
+
+	/* The entity with the network id netId, a null entity if there is none */
+	NODISCARD flecs::entity getNetEntity(u32 netId) const { return netIds.getEntity(netId); }
+
+	/* Bumped every time netId is given to a new entity, tells a recycled id from the entity that had it before */
+	NODISCARD u8 getNetGeneration(u32 netId) const { return netIds.getGeneration(netId); }
+
+	/*
+	 * The server assigns network ids to its networked entities, clients take them from the snapshots they
+	 * apply and record no changes. ClientInterface turns it off.
+	 */
+	void setAssignsNetIds(bool assigns) { assignsNetIds = assigns; }
+	NODISCARD bool getAssignsNetIds() const { return assignsNetIds; }
+
+	template<typename ComponentType>
+	void registerComponent(ComponentPiority piority = ComponentPiority::Low) {
+		auto& entityWorld = getEntityWorld();
+
 		flecs::entity component = entityWorld.component<ComponentType>();
 		CompId id = impl::cf<CompId>(component); 
 
+		if(registeredComponents.find(id) != registeredComponents.end()) {
+			log(ERROR_SEVERITY_WARNING, "Component %s is already registered\n", component.name().c_str());
+			return;
+		}
+		if(componentIds.size() >= maxComponents)
+			log(ERROR_SEVERITY_FATAL, "More than %zu networked components\n", maxComponents);
+
 		ComponentInfo& info = registeredComponents[id];
 
 		info.piority = piority;
+		info.index = (u8)componentIds.size();
+		info.name = component.path().c_str();
+		componentIds.push_back(id);
+
+		const ComponentMask bit = info.getBit();
 
 		registerComponentInfo<ComponentType>(id, piority, std::is_empty<ComponentType>());
+		updateSchema();
 
 		// Adding and Destroying component type 
 		flecs::entity addObserver = 
 			entityWorld.observer()
 			.term<ComponentType>()
 			.event(flecs::OnAdd)
-			.each([this, id](flecs::entity entity){
-				deltaSnapshot.needAdd(entity, id);
+			.each([this, bit](flecs::entity entity){
+				if(EntityId id = getRecordedId(entity))
+					deltaSnapshot.needAdd(id, bit);
 			});
 
 		flecs::entity removeObserver = 
 			entityWorld.observer()
 			.term<ComponentType>()
 			.event(flecs::OnRemove)
-			.each([this, id](flecs::entity entity) {
-				deltaSnapshot.needRemove(entity, id);
+			.each([this, bit](flecs::entity entity) {
+				if(EntityId id = getRecordedId(entity))
+					deltaSnapshot.needRemove(id, bit);
 			});
 
 		allDeltaSnapshotSystems.push_back(addObserver);
 		allDeltaSnapshotSystems.push_back(removeObserver);
 	}
 
+	/*
+	 * A hash of the registered components' names and kinds. Snapshots refer to components by their index in
+	 * name order, so a client can only read them if it registered the same components, in any order.
+	 * Transforms and velocities are quantized, so the QuantizationSettings and the physics world's wrap
+	 * bounds are part of it too and have to be set before connecting.
+	 * ClientInterface sends it when connecting and ServerInterface drops clients whose hash differs.
+	 */
+	NODISCARD u64 getSchemaHash() const {
+		u64 hash = componentSchemaHash;
+		auto hashBytes = [&](const void* data, size_t size) {
+			for(size_t i = 0; i < size; i++)
+				hash = (hash ^ static_cast<const u8*>(data)[i]) * 1099511628211ull;
+		};
+		auto hashValue = [&](auto value) { hashBytes(&value, sizeof(value)); };
+		auto hashBounds = [&](const AABB& bounds) {
+			hashValue(bounds.min[0]); hashValue(bounds.min[1]);
+			hashValue(bounds.max[0]); hashValue(bounds.max[1]);
+		};
+
+		// field by field, the padding of the structs is not hashed
+		hashValue(quantization.enabled);
+		hashBounds(quantization.positionBounds);
+		hashValue(quantization.positionBits);
+		hashValue(quantization.maxOrigin);
+		hashValue(quantization.originBits);
+		hashValue(quantization.angleBits);
+		hashValue(quantization.maxLinearVelocity);
+		hashValue(quantization.linearVelocityBits);
+		hashValue(quantization.maxAngularVelocity);
+		hashValue(quantization.angularVelocityBits);
+
+		const PhysicsWorld& physicsWorld = getPhysicsWorld();
+		hashValue(physicsWorld.isWrapping());
+		if(physicsWorld.isWrapping())
+			hashBounds(physicsWorld.getWrapBounds());
+
+		return hash;
+	}
+
 private:
+	// orders the components by name for the wire and hashes the result, see getSchemaHash()
+	void updateSchema() {
+		wireComponentIds = componentIds;
+		std::sort(wireComponentIds.begin(), wireComponentIds.end(), [&](CompId a, CompId b) {
+			return registeredComponents.find(a)->second.name < registeredComponents.find(b)->second.name;
+		});
+
+		componentSchemaHash = 14695981039346656037ull;
+		auto hashByte = [&](u8 byte) { componentSchemaHash = (componentSchemaHash ^ byte) * 1099511628211ull; };
+		for(size_t i = 0; i < wireComponentIds.size(); i++) {
+			ComponentInfo& info = registeredComponents.find(wireComponentIds[i])->second;
+			info.wireIndex = (u8)i;
+
+			for(char c : info.name)
+				hashByte((u8)c);
+			hashByte(0);
+			hashByte(info.ser ? 1 : 2); // a tag or a component with data
+		}
+	}
+
+	/* mask with the bits of the components' wire indices instead, see serializeArchetypes() */
+	ComponentMask toWireMask(ComponentMask mask) const {
+		ComponentMask wireMask = 0;
+		forEachComponent(mask, [&](CompId compId) {
+			wireMask |= ComponentMask(1) << registeredComponents.find(compId)->second.wireIndex;
+		});
+
+		return wireMask;
+	}
+
 	template<typename TagType>
 	void registerComponentInfo(CompId id, ComponentPiority piority, std::true_type isEmpty) {
 		ComponentInfo& info = registeredComponents[id];
+		const ComponentMask bit = info.getBit();
 
 		info.ser = nullptr;
 		info.des = nullptr;
@@ -821,8 +2096,12 @@ private:
 			.system()
 			.term<TagType>()
 			.template kind<NoPhase>()
-			.each([this, id](flecs::entity entity) {
-				fullSnapshot.tags[impl::cf<EntityId>(entity)].insert(id);
+			.each([this, bit](flecs::entity entity) {
+				EntityId id = netIds.find(entity);
+				if(id && isInFilter(id)) {
+					fullSnapshot.spawnEntities[id] = netIds.getGeneration(id);
+					fullSnapshot.tags[id] |= bit;
+				}
 			});
 
 		fullSnapshotSystems.push_back(fullsnapshotTagAdd);
@@ -832,30 +2111,35 @@ private:
 	void registerComponentInfo(CompId id, ComponentPiority piority, std::false_type isEmpty) {
 		auto& entityWorld = getEntityWorld();
 		ComponentInfo& info = registeredComponents[id];
+		const ComponentMask bit = info.getBit();
 
 		info.ser =
-			[](Serializer& ser, const void* data) {
-				ser.object(*(const ComponentType*)data);
+			[](Serializer& ser, const flecs::entity* entities, size_t count) {
+				for(size_t i = 0; i < count; i++)
+					ser.object(*entities[i].template get<ComponentType>());
 			};
 
 		info.des =
-			[](Deserializer& des, void* data) {
-				des.object((ComponentType&)*(ComponentType*)data);
+			[](Deserializer& des, const flecs::entity* entities, size_t count) {
+				for(size_t i = 0; i < count; i++)
+					des.object(*entities[i].template get_mut<ComponentType>());
 			};
 
 		flecs::entity addObserver = 
 			entityWorld.observer()
 			.term<ComponentType>()
 			.event(flecs::OnAdd)
-			.each([this, id](flecs::entity entity) {
-				deltaSnapshot.needUpdate(entity, id, registeredComponents);
+			.each([this, bit, piority](flecs::entity entity) {
+				if(EntityId id = getRecordedId(entity))
+					deltaSnapshot.needUpdate(id, bit, piority);
 			});
 		flecs::entity setObserver =
 			entityWorld.observer()
 			.term<ComponentType>()
 			.event(flecs::OnSet)
-			.each([this, id](flecs::entity entity) {
-				deltaSnapshot.needUpdate(entity, id, registeredComponents);
+			.each([this, bit, piority](flecs::entity entity) {
+				if(EntityId id = getRecordedId(entity))
+					deltaSnapshot.needUpdate(id, bit, piority);
 			});
 
 		allDeltaSnapshotSystems.push_back(addObserver);
@@ -867,8 +2151,12 @@ private:
 			.template with<NetworkedEntity>()
 			.without(flecs::Prefab)
 			.template kind<NoPhase>()
-			.each([this, id](flecs::entity entity) {
-				fullSnapshot.components[impl::cf<EntityId>(entity)].insert(id);
+			.each([this, bit](flecs::entity entity) {
+				EntityId id = netIds.find(entity);
+				if(id && isInFilter(id)) {
+					fullSnapshot.spawnEntities[id] = netIds.getGeneration(id);
+					fullSnapshot.components[id] |= bit;
+				}
 			});
 
 		fullSnapshotSystems.push_back(fullsnapshotComponentAdd);
@@ -876,106 +2164,349 @@ private:
 
 public:
 	/*
-	 * @brief Create a delta compresesed snapshot that may be sent to clients.
-	 * @param reliableBuffer Data that must be sent reliably (meaning no or minimal packet loss)
-	 * @param unreliableBuffer Data that can be sent unreliably and will not
-	 * heavily impact the client when recieved.
+	 * @brief Closes the changes recorded since the last call into a new snapshot frame
+	 * and returns its sequence number. Called by the server once per network update, before
+	 * any createDeltaSnapshot().
 	 */
-	void createDeltaSnapshot(MessageBuffer& reliableBuffer, MessageBuffer& unreliableBuffer) {
-		/* RELIABLE MESSAGE */
+	u32 sealSnapshot() {
 		deltaSnapshot.checkForDirtyShapes();
 
-		deltaSnapshot.flags = 0;
-		if(deltaSnapshot.state != 0)
-			deltaSnapshot.flags |= impl::STATE;
-		if(deltaSnapshot.metaData.canSerialize())
-			deltaSnapshot.flags |= impl::META_DATA_SNAPSHOT;
-		if(deltaSnapshot.physicsSnapshot.canSerialize())
-			deltaSnapshot.flags |= impl::PHYSICS_SNAPSHOT;
-		if(deltaSnapshot.componentData[(int)ComponentPiority::High].canSerialize())
-			deltaSnapshot.flags |= impl::COMPONENT_UPDATE_SNAPSHOT;
-
-		Serializer ser = startSerialize(reliableBuffer);
+		SnapshotFrame& frame = snapshotHistory[++sequence % snapshotHistory.size()];
+		frame.sequence = sequence;
+		frame.tick = getCurrentTick();
+		frame.stateChanged = deltaSnapshot.state != 0;
+		deltaSnapshot.state = 0;
+
+		// the frame being overwritten hands its containers back to the recorder
+		std::swap(frame.metaData, deltaSnapshot.metaData);
+		std::swap(frame.physicsSnapshot, deltaSnapshot.physicsSnapshot);
+		std::swap(frame.componentData, deltaSnapshot.componentData);
+		deltaSnapshot.resetAll();
+		frame.normalize();
+
+		return sequence;
+	}
+
+	/* The sequence number of the last sealed snapshot */
+	NODISCARD u32 getSnapshotSequence() const { return sequence; }
+
+	/* How many sealed snapshots are kept to encode deltas against. A client whose baseline is older needs a full snapshot */
+	void setSnapshotHistoryLength(u32 length) {
+		assert(length > 0);
+
+		snapshotHistory.clear();
+		snapshotHistory.resize(length);
+	}
+
+	NODISCARD u32 getSnapshotHistoryLength() const { return (u32)snapshotHistory.size(); }
+
+	/* Are all snapshots after baseline still in the history? */
+	NODISCARD bool canCreateDeltaSnapshot(u32 baseline) const {
+		if (baseline > sequence || sequence - baseline > snapshotHistory.size())
+			return false;
+
+		for (u32 seq = baseline + 1; seq <= sequence; seq++) {
+			if (snapshotHistory[seq % snapshotHistory.size()].sequence != seq)
+				return false;
+		}
+
+		return true;
+	}
+
+	/*
+	 * @brief Creates a snapshot taking a client from baseline, the last snapshot it acknowledged,
+	 * to the last sealed snapshot. Every change sealed after baseline is included, so a lost
+	 * snapshot is healed by the next one and nothing has to be sent reliably.
+	 * 
+	 * Changes are resolved against the current world instead of being replayed, e.g. a component
+	 * that was added and removed again after baseline is only sent as a removal.
+	 * 
+	 * @note canCreateDeltaSnapshot(baseline) must be true
+	 */
+	void createDeltaSnapshot(MessageBuffer& buffer, u32 baseline) {
+		createDeltaSnapshot(buffer, baseline, encoder);
+	}
+
+	/* Thread safe as long as every thread has its own encoder, see SnapshotEncoder */
+	void createDeltaSnapshot(MessageBuffer& buffer, u32 baseline, SnapshotEncoder& encoder) {
+		assert(canCreateDeltaSnapshot(baseline));
+
+		serializeDeltaSnapshot(buffer, baseline, mergeSnapshotFrames(baseline, encoder), encoder);
+	}
+
+	/*
+	 * What the server remembers about a client that is sent its own snapshots, because it only sees
+	 * part of the world or has a byte budget. See createClientSnapshot().
+	 */
+	class ClientView {
+	public:
+		flecs::entity viewEntity; // entities near it are sent first, with a viewRadius only they are sent
+		float viewRadius = 0.0f; // 0 sees the whole world
+		size_t byteBudget = 0; // per snapshot, 0 is unlimited
+
+		/* Did the client have everything it sees once it applied the snapshot sequence? False if unknown */
+		NODISCARD bool isComplete(u32 sequence) const {
+			const SentSnapshot* snapshot = findSent(sequence);
+			return snapshot && snapshot->complete;
+		}
+
+		/* Forgets what was sent, the next snapshot has to be a full one */
+		void reset() {
+			for (SentSnapshot& snapshot : sent)
+				snapshot.sequence = 0;
+
+			priorities.clear();
+		}
+
+	private:
+		friend class NetworkStateManager;
+
+		struct SentSnapshot {
+			u32 sequence = 0;
+			EntityIdList known; // the entities the client has once it applied the snapshot
+			EntityIdList owed; // known entities with changes that did not fit the budget
+			bool complete = false; // nothing was left out, see isComplete()
+		};
+
+		NODISCARD const SentSnapshot* findSent(u32 sequence) const {
+			if (sent.empty())
+				return nullptr;
+
+			const SentSnapshot& snapshot = sent[sequence % sent.size()];
+			return snapshot.sequence == sequence ? &snapshot : nullptr;
+		}
+
+		SentSnapshot& recordSent(u32 sequence, size_t historyLength) {
+			if (sent.size() != historyLength)
+				sent.assign(historyLength, SentSnapshot());
+
+			SentSnapshot& snapshot = sent[sequence % sent.size()];
+			snapshot.sequence = sequence;
+			return snapshot;
+		}
+
+		std::vector<SentSnapshot> sent; // indexed by sequence like the snapshot history
+		Map<EntityId, float> priorities; // of entities that were left out, they are sent first next time
+	};
+
+	/* Is baseline both in the snapshot history and a snapshot that was sent to view? */
+	NODISCARD bool canCreateClientSnapshot(const ClientView& view, u32 baseline) const {
+		return view.findSent(baseline) && canCreateDeltaSnapshot(baseline);
+	}
+
+	/*
+	 * @brief Like createDeltaSnapshot() but for a single client, see ClientView.
+	 * 
+	 * Only the entities the client can see are sent, see findRelevantEntities(). Entities that came
+	 * into view are sent whole and entities that left it are destroyed on the client like dead ones.
+	 * 
+	 * With a byte budget, removals and added or removed components are always sent. Entities with
+	 * changes then fill what is left of the budget by priority: the weight of their changes, see
+	 * PrioritySettings, plus what they accumulated while left out. Left out changes are sent with a
+	 * later snapshot, the baseline remembers which entities are owed one.
+	 * 
+	 * @note canCreateClientSnapshot(view, baseline) must be true
+	 */
+	void createClientSnapshot(MessageBuffer& buffer, u32 baseline, ClientView& view) {
+		findViewEntities(view, encoder.client.relevant);
+		createClientSnapshot(buffer, baseline, view, encoder.client.relevant, encoder);
+	}
+
+	/*
+	 * @brief Same as above with relevant found by findViewEntities() beforehand, which has to happen on
+	 * the main thread. Thread safe for different views as long as every thread has its own encoder.
+	 */
+	void createClientSnapshot(MessageBuffer& buffer, u32 baseline, ClientView& view, const EntityIdList& relevant, SnapshotEncoder& encoder) {
+		assert(canCreateClientSnapshot(view, baseline));
+
+		const ClientView::SentSnapshot& sentBaseline = *view.findSent(baseline);
+		ClientScratch& scratch = encoder.client;
+
+		MergedSnapshot& filtered = filterMergedSnapshot(mergeSnapshotFrames(baseline, encoder), sentBaseline.known, sentBaseline.owed, relevant, view, encoder);
+		serializeDeltaSnapshot(buffer, baseline, filtered, encoder);
+
+		// the baseline may share its slot with the new snapshot, so this happens last
+		ClientView::SentSnapshot& sent = view.recordSent(sequence, snapshotHistory.size());
+		std::swap(sent.known, scratch.known);
+		std::swap(sent.owed, scratch.owed);
+		sent.complete = scratch.complete;
+	}
+
+	/**
+	 * @brief Creates a full snapshot of the entities a client can see, deltas for it can start from this one
+	 */
+	void createClientFullSnapshot(MessageBuffer& buffer, ClientView& view) {
+		EntityIdList& relevant = encoder.client.relevant;
+		findViewEntities(view, relevant);
+
+		interestFilter = &relevant;
+		createFullSnapshot(buffer);
+		interestFilter = nullptr;
+
+		ClientView::SentSnapshot& sent = view.recordSent(sequence, snapshotHistory.size());
+		sent.known.assign(relevant.begin(), relevant.end());
+		sent.owed.clear();
+		sent.complete = true;
+		view.priorities.clear();
+	}
+
+	/**
+	 * @brief Creates a full snapshot without entities, deltas for view can start from this one. Everything
+	 * the client sees then comes into view at once, so with a byte budget the world is streamed over
+	 * several deltas: the most important entities first, see PrioritySettings and ClientView::isComplete().
+	 */
+	void createClientEmptySnapshot(MessageBuffer& buffer, ClientView& view) {
+		// written directly, running fullSnapshotSystems over the world for every client that joins would stall the server
+		Serializer ser = startSerialize(buffer);
+		serializeFullSnapshotHeader(ser);
+		serializeVarint(ser, ListSize(0)); // Spawned Entities
+		serializeVarint(ser, ListSize(0)); // Tag Archetypes
+		serializeVarint(ser, ListSize(0)); // Component Archetypes
+		serializeVarint(ser, ListSize(0)); // Physics Groups
+		endSerialize(ser, buffer);
+
+		ClientView::SentSnapshot& sent = view.recordSent(sequence, snapshotHistory.size());
+		sent.known.clear();
+		sent.owed.clear();
+		sent.complete = false;
+		view.priorities.clear();
+	}
+
+	/*
+	 * @brief Fills relevant with the networked entities whose shapes are in the square of
+	 * half size radius around viewer's shape, plus every networked entity without a shape
+	 * and viewer itself. A viewer without a shape only sees the shapeless entities.
+	 */
+	void findRelevantEntities(flecs::entity viewer, float radius, EntityIdList& relevant) {
+		relevant.clear();
+
+		shapelessQuery.iter([&](flecs::iter& iter) {
+			for (auto i : iter)
+				if (EntityId id = netIds.find(iter.entity(i)))
+					relevant.push_back(id);
+		});
+
+		if (EntityId id = viewer.is_alive() ? netIds.find(viewer) : 0)
+			relevant.push_back(id);
+
+		const ShapeComponent* viewShape = viewer.is_alive() ? viewer.get<ShapeComponent>() : nullptr;
+		if (viewShape && viewShape->isValid()) {
+			PhysicsWorld& physicsWorld = getPhysicsWorld();
+			const AABB view(radius, radius, physicsWorld.getShape(viewShape->shape).getPos());
+
+			physicsWorld.query(view, [&](SpatialIndexElement& element, sf::Vector2f) {
+				flecs::entity entity = impl::af(element.entityId);
+				if (EntityId id = entity.is_valid() ? netIds.find(entity) : 0)
+					relevant.push_back(id);
+			});
+		}
+
+		std::sort(relevant.begin(), relevant.end());
+		relevant.erase(std::unique(relevant.begin(), relevant.end()), relevant.end());
+	}
+
+	/* Every networked entity if view has no radius, see findNetworkedEntities() */
+	void findViewEntities(const ClientView& view, EntityIdList& relevant) {
+		if (view.viewRadius > 0.0f)
+			findRelevantEntities(view.viewEntity, view.viewRadius, relevant);
+		else
+			findNetworkedEntities(relevant);
+	}
+
+	/* Fills entities with every networked entity, what a view without a radius sees */
+	void findNetworkedEntities(EntityIdList& entities) {
+		entities.clear();
+		networkedQuery.iter([&](flecs::iter& iter) {
+			for (auto i : iter)
+				if (EntityId id = netIds.find(iter.entity(i)))
+					entities.push_back(id);
+		});
+
+		std::sort(entities.begin(), entities.end());
+	}
+
+private:
+	void serializeDeltaSnapshot(MessageBuffer& buffer, u32 baseline, MergedSnapshot& merged, SnapshotEncoder& encoder) {
+		u8 flags = 0;
+		if(merged.stateChanged)
+			flags |= impl::STATE;
+		if(merged.metaData.canSerialize())
+			flags |= impl::META_DATA_SNAPSHOT;
+		if(merged.physicsSnapshot.canSerialize())
+			flags |= impl::PHYSICS_SNAPSHOT;
+		if(merged.componentData[(int)ComponentPiority::High].canSerialize())
+			flags |= impl::COMPONENT_UPDATE_SNAPSHOT;
+		if(merged.componentData[(int)ComponentPiority::Low].canSerialize())
+			flags |= impl::LOW_PIORITY;
+
+		Serializer ser = startSerialize(buffer);
 		// HEADER
 		ser.object(MESSAGE_HEADER_DELTA_SNAPSHOT);
-		ser.object(deltaSnapshot.flags);
+		serializeVarint(ser, sequence);
+		serializeVarint(ser, sequence - baseline);
+		ser.ext8b(snapshotHistory[sequence % snapshotHistory.size()].tick, bitsery::ext::CompactValue{});
+		ser.object(flags);
 		// State
-		if(deltaSnapshot.flags & impl::STATE) {
+		if(flags & impl::STATE) {
 			ser.object(getCurrentStateId());
-			deltaSnapshot.state = 0;
 		}
 		// Meta Data
-		if(deltaSnapshot.flags & impl::META_DATA_SNAPSHOT) {
-			MetaDataSnapshot& metaData = deltaSnapshot.metaData;
-			serializeSet(ser, metaData.removeEntities);
-			sortByArchetypes(metaData.toAdd);
-			serializeArchetypes(ser, cache.archetypeMap, nullptr);
-			sortByArchetypes(metaData.toRemove);
-			serializeArchetypes(ser, cache.archetypeMap, nullptr);
-			serializeMap(ser, metaData.toUpdateActive);
+		if(flags & impl::META_DATA_SNAPSHOT) {
+			MetaDataSnapshot& metaData = merged.metaData;
+			serializeSortedIds(ser, metaData.removeEntities.getIds());
+			serializeTable(ser, metaData.spawnEntities);
+			sortByArchetypes(encoder, metaData.toAdd);
+			serializeArchetypes(ser, encoder, nullptr);
+			sortByArchetypes(encoder, metaData.toRemove);
+			serializeArchetypes(ser, encoder, nullptr);
+			serializeTable(ser, metaData.toUpdateActive);
 		}
 		// Physics Data
-		if(deltaSnapshot.flags & impl::PHYSICS_SNAPSHOT) {
-			auto& physicsWorld = getPhysicsWorld();
-			PhysicsSnapshot& physicsData = deltaSnapshot.physicsSnapshot;
-			serializePhysicsMap(ser, physicsData.bodiesToUpdate, [&](Serializer& ser, ShapeEnum shapeEnum, PhysicsId id) {
-				switch (shapeEnum) {
-				case ShapeEnum::Circle:
-					ser.object(physicsWorld.getCircle((u32)id));
-					break;
-				case ShapeEnum::Polygon:
-					ser.object(physicsWorld.getPolygon((u32)id));
-					break;
-
-				default:
-					assert(!"Invalid shape enum");
-					break;
-				}
+		if(flags & impl::PHYSICS_SNAPSHOT) {
+			serializePhysicsMap(ser, merged.physicsSnapshot.bodiesToUpdate, [&](Serializer& ser, ShapeEnum shapeEnum, PhysicsId id) {
+				serializeShape(ser, id);
 			});
 		}
-		// High Piortiy Component Updates
-		if(deltaSnapshot.flags & impl::COMPONENT_UPDATE_SNAPSHOT) {
-			sortByArchetypes(deltaSnapshot.componentData[(int)ComponentPiority::High].toUpdate);
-			serializeArchetypes(ser, cache.archetypeMap, [&](Serializer& ser, EntityId entityId, CompId compId){
-				flecs::entity entity = impl::af(entityId);
-
-				registeredComponents[compId].ser(ser, entity.get(compId));
+		// Component Updates, high piority first
+		for(ComponentPiority piority : { ComponentPiority::High, ComponentPiority::Low }) {
+			if(!merged.componentData[(int)piority].canSerialize())
+				continue;
+
+			sortByArchetypes(encoder, merged.componentData[(int)piority].toUpdate);
+			serializeArchetypes(ser, encoder, [&](Serializer& ser, const std::vector<flecs::entity>& entities, CompId compId) {
+				registeredComponents.find(compId)->second.ser(ser, entities.data(), entities.size());
 			});
 		}
-		endSerialize(ser, reliableBuffer);
-
-		/* UNRELIABLE MESSAGE */
-		deltaSnapshot.flags = impl::LOW_PIORITY;
-		if(deltaSnapshot.componentData[(int)ComponentPiority::Low].canSerialize())
-			deltaSnapshot.flags |= impl::COMPONENT_UPDATE_SNAPSHOT;
-
-		ser = startSerialize(unreliableBuffer);
-		// Header
-		ser.object(MESSAGE_HEADER_DELTA_SNAPSHOT);
-		ser.object(deltaSnapshot.flags);
-		// Low Piortiy Component Updates
-		if(deltaSnapshot.flags & impl::COMPONENT_UPDATE_SNAPSHOT) {
-			sortByArchetypes(deltaSnapshot.componentData[(int)ComponentPiority::Low].toUpdate);
-			serializeArchetypes(ser, cache.archetypeMap, [&](Serializer& ser, EntityId entityId, CompId compId) {
-				flecs::entity entity = impl::af(entityId);
-
-				registeredComponents[compId].ser(ser, entity.get(compId));
-			});
-		}
-		endSerialize(ser, unreliableBuffer);
-
-		// cleanup ...
-		deltaSnapshot.resetAll();
+		endSerialize(ser, buffer);
 	}
 
+public:
 	/**
-	 * @brief Updates the games current state with a delta snapshot
+	 * @brief Updates the games current state with a delta snapshot.
+	 * 
+	 * @return false if the snapshot was dropped, either because a newer one was already applied
+	 * or because it was encoded against a snapshot this client has not applied yet.
 	 */
-	void updateWithDeltaSnapshot(Deserializer& des) {
-		auto& entityWorld = getEntityWorld();
-		auto& physicsWorld = getPhysicsWorld();
+	bool updateWithDeltaSnapshot(Deserializer& des) {
+		u32 snapshotSequence, baselineDistance;
+		u64 snapshotTick;
+		deserializeVarint(des, snapshotSequence);
+		deserializeVarint(des, baselineDistance);
+		des.ext8b(snapshotTick, bitsery::ext::CompactValue{});
+
+		if(baselineDistance > snapshotSequence) {
+			des.adapter().error(bitsery::ReaderError::InvalidData);
+			return false;
+		}
 
-		entityWorld.enable_range_check(false);
+		if(!hasAppliedFullSnapshot || snapshotSequence <= lastAppliedSequence || snapshotSequence - baselineDistance > lastAppliedSequence) {
+			des.adapter().currentReadPos(des.adapter().currentReadEndPos()); // skip the rest, it is not malformed
+			return false;
+		}
+
+		for(ApplyCallbacks& callbacks : applyCallbacks)
+			if(callbacks.beforeApply)
+				callbacks.beforeApply();
 
 		u8 flags;
 		des.object(flags);
@@ -988,24 +2519,33 @@ public:
 		if(flags & impl::META_DATA_SNAPSHOT) {
 			// Entities to kill
 			deserializeSet<EntityId>(des, [&](EntityId id){
-				flecs::entity toDestroy = getEntityWorld().ensure(id);
+				flecs::entity toDestroy = netIds.getEntity(id);
+				if(toDestroy.is_valid())
+					toDestroy.destruct();
+
+				netIds.unbind(id);
+			});
 
-				toDestroy.destruct();
+			// Entities new to us
+			deserializeMap<EntityId, u8>(des, [&](EntityId id, u8 generation) {
+				spawnNetEntity(des, id, generation);
 			});
 
 			// Components to add
-			deserializeArchetypes(des, [](Deserializer& des, flecs::entity entity, CompId compId){
-				entity.add(compId);
+			deserializeArchetypes(des, [](Deserializer& des, const std::vector<flecs::entity>& entities, CompId compId){
+				for(flecs::entity entity : entities)
+					entity.add(compId);
 			});
 			
 			// Components to remove
-			deserializeArchetypes(des, [](Deserializer& des, flecs::entity entity, CompId compId) {
-				entity.remove(compId);
+			deserializeArchetypes(des, [](Deserializer& des, const std::vector<flecs::entity>& entities, CompId compId) {
+				for(flecs::entity entity : entities)
+					entity.remove(compId);
 			});
 
 			// Disable or enable entities
-			deserializeMap<EntityId, u8>(des, [](EntityId id, u8 activeFlags){
-				flecs::entity entity = impl::af(id);
+			deserializeMap<EntityId, u8>(des, [&](EntityId id, u8 activeFlags){
+				flecs::entity entity = netIds.getEntity(id);
 
 				assert(entity.id() != 0);
 				assert(activeFlags);
@@ -1019,287 +2559,869 @@ public:
 			
 		}
 		if (flags & impl::PHYSICS_SNAPSHOT) {
-			deserializePhysicsMap(des, [&](Deserializer& des, ShapeEnum shapeEnum, PhysicsId shortId){
-				u32 id = (u32)shortId;
-
-				switch (shapeEnum) {
-				case ShapeEnum::Circle:
-					if(physicsWorld.doesShapeExist(id))
-						des.object(physicsWorld.getCircle(id));
-					else
-						des.object(physicsWorld.getCircle(physicsWorld.insertShape<Circle>(id)));
-					break;
-				case ShapeEnum::Polygon:
-					if (physicsWorld.doesShapeExist(id))
-						des.object(physicsWorld.getPolygon(id));
-					else
-						des.object(physicsWorld.getPolygon(physicsWorld.insertShape<Polygon>(id)));
-					break;
-
-				default:
-					assert(!"Invalid shape enum");
-					break;
-				}
+			deserializePhysicsMap(des, [&](Deserializer& des, ShapeEnum shapeEnum, PhysicsId id){
+				deserializeShape(des, shapeEnum, id);
+			});
+
+		}
+		for (u8 componentFlag : { (u8)impl::COMPONENT_UPDATE_SNAPSHOT, (u8)impl::LOW_PIORITY }) {
+			if (!(flags & componentFlag))
+				continue;
+
+			deserializeArchetypes(des, [&](Deserializer& des, const std::vector<flecs::entity>& entities, CompId compId) {
+				deserializeComponentColumn(des, entities, compId);
+			});
+		}
+
+		lastAppliedSequence = snapshotSequence;
+		lastAppliedTick = snapshotTick;
+
+		for(ApplyCallbacks& callbacks : applyCallbacks)
+			if(callbacks.afterApply)
+				callbacks.afterApply();
+
+		return true;
+	}
+
+	/* The sequence number of the newest snapshot applied by this client, this is what it acknowledges to the server */
+	NODISCARD u32 getLastAppliedSequence() const { return lastAppliedSequence; }
+
+	/* The server tick the newest snapshot applied by this client was taken at */
+	NODISCARD u64 getLastAppliedTick() const { return lastAppliedTick; }
+
+	/* Client side, false until the first full snapshot of this session, deltas are dropped before it */
+	NODISCARD bool getHasAppliedFullSnapshot() const { return hasAppliedFullSnapshot; }
+
+public:
+	/**
+	 * @brief Creates a full snapshot of the world
+	 */
+	void createFullSnapshot(MessageBuffer& buffer) {
+		auto& world = getEntityWorld();
+
+		for(auto system : fullSnapshotSystems) {
+			world.system(system).run(0.0f);
+		}
+
+		Serializer ser = startSerialize(buffer);
+		serializeFullSnapshotHeader(ser);
+		serializeTable(ser, fullSnapshot.spawnEntities);
+		sortByArchetypes(encoder, fullSnapshot.tags);
+		serializeArchetypes(ser, encoder, nullptr);
+		sortByArchetypes(encoder, fullSnapshot.components);
+		serializeArchetypes(ser, encoder, [&](Serializer& ser, const std::vector<flecs::entity>& entities, CompId compId) {
+			registeredComponents.find(compId)->second.ser(ser, entities.data(), entities.size());
+		});
+		serializePhysicsMap(ser, fullSnapshot.physicsSnapshot.bodiesToUpdate, [&](Serializer& ser, ShapeEnum shapeEnum, PhysicsId id) {
+			serializeShape(ser, id);
+		});
+		endSerialize(ser, buffer);
+
+		fullSnapshot.resetAll();
+	}
+
+	/**
+	 * @brief Updates the games current state with a full snapshot.
+	 * This will delete all networked entities and then reconstruct
+	 * the world according to the message.
+	 * 
+	 * @return false if the snapshot was dropped because a newer delta snapshot was already applied
+	 */
+	bool updateWithFullSnapshot(Deserializer& des) {
+		u32 snapshotSequence;
+		u64 snapshotTick;
+		deserializeVarint(des, snapshotSequence);
+		des.ext8b(snapshotTick, bitsery::ext::CompactValue{});
+
+		if(hasAppliedFullSnapshot && snapshotSequence < lastAppliedSequence) {
+			des.adapter().currentReadPos(des.adapter().currentReadEndPos());
+			return false;
+		}
+
+		flecs::world& entityWorld = getEntityWorld();
+
+		for(ApplyCallbacks& callbacks : applyCallbacks)
+			if(callbacks.beforeApply)
+				callbacks.beforeApply();
+
+		entityWorld.delete_with<NetworkedEntity>();
+		netIds.clear();
+
+		u64 stateId;
+		des.object(stateId);
+		transitionState(stateId, true);
+
+		deserializeMap<EntityId, u8>(des, [&](EntityId id, u8 generation) {
+			spawnNetEntity(des, id, generation);
+		});
+		deserializeArchetypes(des, [](Deserializer& des, const std::vector<flecs::entity>& entities, CompId compId) {
+			for(flecs::entity entity : entities)
+				entity.add(compId);
+		});
+		deserializeArchetypes(des, [&](Deserializer& des, const std::vector<flecs::entity>& entities, CompId compId) {
+			deserializeComponentColumn(des, entities, compId);
+		});
+		deserializePhysicsMap(des, [&](Deserializer& des, ShapeEnum shapeEnum, PhysicsId id) {
+			deserializeShape(des, shapeEnum, id);
+		});
+
+		hasAppliedFullSnapshot = true;
+		lastAppliedSequence = snapshotSequence;
+		lastAppliedTick = snapshotTick;
+
+		for(ApplyCallbacks& callbacks : applyCallbacks)
+			if(callbacks.afterApply)
+				callbacks.afterApply();
+
+		return true;
+	}
+
+	/* Clients call this when connecting, so snapshots of a previous session don't shadow the new ones */
+	void resetLastAppliedSequence() {
+		lastAppliedSequence = 0;
+		lastAppliedTick = 0;
+		hasAppliedFullSnapshot = false;
+
+		for(InputAck& ack : inputAcks)
+			ack = InputAck();
+	}
+
+	/* Client side, inputTick is the newest input the server had applied when it sealed snapshotSequence */
+	void recordInputAck(u32 snapshotSequence, u64 inputTick) {
+		inputAcks[snapshotSequence % inputAcks.size()] = { snapshotSequence, inputTick };
+	}
+
+	/* The newest input reflected by the last applied snapshot, 0 if unknown. See InputChannel */
+	NODISCARD u64 getAppliedInputAck() const {
+		// the ack of the applied snapshot may have been lost, the one before it is the next best thing
+		for(u32 age = 0; age < inputAcks.size() && age < lastAppliedSequence; age++) {
+			const InputAck& ack = inputAcks[(lastAppliedSequence - age) % inputAcks.size()];
+			if(ack.sequence == lastAppliedSequence - age)
+				return ack.inputTick;
+		}
+
+		return 0;
+	}
+
+private:
+	/*
+	 * Folds the frames (baseline, sequence] into encoder.merged, then resolves the result against
+	 * the current world: touched components become adds or removes depending on whether the entity
+	 * has them now, and anything belonging to a dead entity or shape is dropped.
+	 */
+	MergedSnapshot& mergeSnapshotFrames(u32 baseline, SnapshotEncoder& encoder) {
+		MergedSnapshot& merged = encoder.merged;
+
+		// clients sharing a baseline share the merge, as long as the world did not change in between
+		if(merged.baseline == baseline && merged.sequence == sequence && merged.tick == getCurrentTick())
+			return merged;
+
+		merged.resetAll();
+		merged.baseline = baseline;
+		merged.sequence = sequence;
+		merged.tick = getCurrentTick();
+
+		for(u32 seq = baseline + 1; seq <= sequence; seq++) {
+			const SnapshotFrame& frame = snapshotHistory[seq % snapshotHistory.size()];
+
+			merged.stateChanged |= frame.stateChanged;
+			for(EntityId id : frame.metaData.removeEntities.getIds())
+				merged.metaData.removeEntities.insert(id);
+			frame.metaData.spawnEntities.forEach([&](EntityId id, u8 generation) { merged.metaData.spawnEntities[id] = generation; });
+			frame.metaData.toAdd.forEach([&](EntityId id, ComponentMask mask) { merged.touchedComponents[id] |= mask; });
+			frame.metaData.toRemove.forEach([&](EntityId id, ComponentMask mask) { merged.touchedComponents[id] |= mask; });
+			for(EntityId id : frame.metaData.toUpdateActive.getIds())
+				merged.touchedActive.insert(id);
+			for(size_t piority = 0; piority < frame.componentData.size(); piority++)
+				frame.componentData[piority].toUpdate.forEach([&](EntityId id, ComponentMask mask) {
+					merged.componentData[piority].toUpdate[id] |= mask;
+				});
+			for(auto& pair : frame.physicsSnapshot.bodiesToUpdate) {
+				std::vector<PhysicsId>& ids = merged.physicsSnapshot.bodiesToUpdate[pair.first];
+				ids.insert(ids.end(), pair.second.begin(), pair.second.end());
+			}
+		}
+
+		// an entity that spawned and died again after the baseline is only sent as a removal
+		merged.metaData.spawnEntities.forEach([&](EntityId id, u8 generation) {
+			if(!netIds.getEntity(id).is_valid() || netIds.getGeneration(id) != generation)
+				merged.metaData.spawnEntities.erase(id);
+		});
+
+		merged.touchedComponents.forEach([&](EntityId id, ComponentMask touched) {
+			flecs::entity entity = netIds.getEntity(id);
+			if(!entity.is_valid())
+				return; // removeEntities takes care of it
+
+			const ComponentMask has = getComponentMask(entity, touched);
+			if(has)
+				merged.metaData.toAdd[id] = has;
+			if(touched & ~has)
+				merged.metaData.toRemove[id] = touched & ~has;
+		});
+
+		for(EntityId id : merged.touchedActive.getIds()) {
+			flecs::entity entity = netIds.getEntity(id);
+			if(entity.is_valid())
+				merged.metaData.toUpdateActive[id] = entity.enabled() ? MetaDataSnapshot::DO_ENABLE : MetaDataSnapshot::DO_DISABLE;
+		}
+
+		for(ComponentSnapshot& componentData : merged.componentData) {
+			componentData.toUpdate.forEach([&](EntityId id, ComponentMask& mask) {
+				flecs::entity entity = netIds.getEntity(id);
+
+				if(entity.is_valid())
+					mask = getComponentMask(entity, mask);
+
+				if(!entity.is_valid() || mask == 0)
+					componentData.toUpdate.erase(id);
+			});
+		}
+
+		PhysicsWorld& physicsWorld = getPhysicsWorld();
+		for(auto& pair : merged.physicsSnapshot.bodiesToUpdate) {
+			std::vector<PhysicsId>& ids = pair.second;
+			ids.erase(std::remove_if(ids.begin(), ids.end(), [&](PhysicsId id) { return !physicsWorld.doesShapeExist(id); }), ids.end());
+			std::sort(ids.begin(), ids.end());
+			ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+		}
+
+		return merged;
+	}
+
+	/*
+	 * Narrows merged down to what the client of view needs into encoder.filtered, see createClientSnapshot().
+	 * known and owed are from the client's baseline, relevant is what it sees now.
+	 * Fills known, owed and complete of encoder.client for the new snapshot.
+	 */
+	MergedSnapshot& filterMergedSnapshot(const MergedSnapshot& merged, const EntityIdList& known, const EntityIdList& owed, const EntityIdList& relevant, ClientView& view, SnapshotEncoder& encoder) {
+		MergedSnapshot& filtered = encoder.filtered;
+		filtered.resetAll();
+		filtered.stateChanged = merged.stateChanged;
+
+		ClientScratch& clientScratch = encoder.client;
+		std::vector<Candidate>& candidates = clientScratch.candidates;
+		clientScratch.known.clear();
+		clientScratch.owed.clear();
+		clientScratch.complete = true;
+		candidates.clear();
+
+		auto contains = [](const EntityIdList& list, EntityId id) { return std::binary_search(list.begin(), list.end(), id); };
+		auto died = [&](EntityId id) { return merged.metaData.removeEntities.contains(id); };
+		// the client has the same entity and still sees it
+		auto stayed = [&](EntityId id) { return contains(known, id) && contains(relevant, id) && !died(id); };
+
+		for(EntityId id : known) {
+			if(died(id) || !contains(relevant, id))
+				filtered.metaData.removeEntities.insert(id);
+		}
+
+		// entities sent after the baseline may be on the client already, their ack just did not arrive yet
+		for(const ClientView::SentSnapshot& sent : view.sent) {
+			if(sent.sequence <= merged.baseline || sent.sequence > merged.sequence)
+				continue;
+
+			for(EntityId id : sent.known) {
+				if(died(id) || !contains(relevant, id))
+					filtered.metaData.removeEntities.insert(id);
+			}
+		}
+
+		for(EntityId id : relevant) {
+			if(!stayed(id)) {
+				candidates.push_back({ id, Candidate::ENTERED });
+				continue;
+			}
+
+			clientScratch.known.push_back(id);
+
+			if(contains(owed, id))
+				candidates.push_back({ id, Candidate::OWED });
+			else if(hasMergedChanges(merged, id, netIds.getEntity(id)))
+				candidates.push_back({ id, Candidate::CHANGED });
+		}
+
+		merged.metaData.spawnEntities.forEach([&](EntityId id, u8 generation) {
+			if(stayed(id))
+				filtered.metaData.spawnEntities[id] = generation;
+		});
+		merged.metaData.toAdd.forEach([&](EntityId id, ComponentMask mask) {
+			if(stayed(id))
+				filtered.metaData.toAdd[id] = mask;
+		});
+		merged.metaData.toRemove.forEach([&](EntityId id, ComponentMask mask) {
+			if(stayed(id))
+				filtered.metaData.toRemove[id] = mask;
+		});
+		merged.metaData.toUpdateActive.forEach([&](EntityId id, u8 flags) {
+			if(stayed(id))
+				filtered.metaData.toUpdateActive[id] = flags;
+		});
+
+		if(view.byteBudget > 0)
+			prioritizeCandidates(merged, filtered, view, encoder);
+
+		for(const Candidate& candidate : candidates) {
+			flecs::entity entity = netIds.getEntity(candidate.id);
+
+			if(candidate.deferred) {
+				clientScratch.complete = false;
+				view.priorities[candidate.id] = candidate.score;
+				if(candidate.kind != Candidate::ENTERED)
+					clientScratch.owed.push_back(candidate.id); // the client keeps the entity, but it is behind
+				continue;
+			}
+
+			view.priorities.erase(candidate.id);
+			switch(candidate.kind) {
+			case Candidate::ENTERED:
+				addWholeEntity(filtered, candidate.id, entity);
+				clientScratch.known.push_back(candidate.id);
+				break;
+			case Candidate::OWED:
+				addEntityValues(filtered, candidate.id, entity);
+				break;
+			case Candidate::CHANGED:
+				addMergedChanges(merged, filtered, candidate.id, entity);
+				break;
+			}
+		}
+
+		// entities that left the view start from nothing when they come back
+		for(auto it = view.priorities.begin(); it != view.priorities.end();)
+			it = contains(relevant, it->first) ? std::next(it) : view.priorities.erase(it);
+
+		std::sort(clientScratch.known.begin(), clientScratch.known.end());
+		return filtered;
+	}
+
+	/* Marks the candidates that do not fit view's budget as deferred, the most important go first */
+	void prioritizeCandidates(const MergedSnapshot& merged, const MergedSnapshot& filtered, ClientView& view, SnapshotEncoder& encoder) {
+		std::vector<Candidate>& candidates = encoder.client.candidates;
+		PhysicsWorld& physicsWorld = getPhysicsWorld();
+
+		const ShapeComponent* viewShape = view.viewEntity.is_alive() ? view.viewEntity.get<ShapeComponent>() : nullptr;
+		const bool hasViewPos = viewShape && viewShape->isValid();
+		const sf::Vector2f viewPos = hasViewPos ? physicsWorld.getShape(viewShape->shape).getPos() : sf::Vector2f();
+		const float viewRadius = view.viewRadius > 0.0f ? view.viewRadius : priorities.worldViewRadius;
+
+		for(Candidate& candidate : candidates) {
+			flecs::entity entity = netIds.getEntity(candidate.id);
+			selectCandidateContent(merged, candidate, entity);
+
+			float weight = candidate.withShape ? priorities.highPiorityWeight : 0.0f;
+			forEachComponent(candidate.components, [&](CompId compId) {
+				const ComponentInfo& info = registeredComponents.find(compId)->second;
+				weight = std::max(weight, info.piority == ComponentPiority::High ? priorities.highPiorityWeight : priorities.lowPiorityWeight);
+			});
+			if(candidate.kind == Candidate::ENTERED)
+				weight *= priorities.enterWeight;
+
+			const ShapeComponent* shapeComp = entity.get<ShapeComponent>();
+			if(hasViewPos && shapeComp && shapeComp->isValid()) {
+				const sf::Vector2f pos = physicsWorld.getShape(shapeComp->shape).getPos();
+				const sf::Vector2f delta = pos + physicsWorld.getMinimumImageOffset(viewPos, pos) - viewPos;
+				const float distance = std::sqrt(delta.x * delta.x + delta.y * delta.y);
+
+				weight *= viewRadius / (viewRadius + distance * priorities.distanceFalloff);
+			}
+
+			auto it = view.priorities.find(candidate.id);
+			candidate.score = (it != view.priorities.end() ? it->second : 0.0f) + weight;
+		}
+
+		std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.score > b.score; });
+
+		// removals and component adds and removes are always sent, approximate what they cost
+		size_t used = 16 + filtered.metaData.removeEntities.size() * 2 + filtered.metaData.toUpdateActive.size() * 3;
+		auto addMaskCost = [&](EntityId, ComponentMask mask) { used += 2 + std::bitset<maxComponents>(mask).count(); };
+		filtered.metaData.toAdd.forEach(addMaskCost);
+		filtered.metaData.toRemove.forEach(addMaskCost);
+
+		// once a candidate doesn't fit, only a few more are measured to fill the rest of the budget with smaller
+		// ones, everything after that waits for a later snapshot
+		bool anySent = false;
+		size_t fillLeft = priorities.fillCandidates;
+		bool missed = false;
+		for(Candidate& candidate : candidates) {
+			if(missed && fillLeft == 0) {
+				candidate.deferred = true;
+				continue;
+			}
+
+			if(missed)
+				fillLeft--;
+
+			candidate.size = measureCandidate(candidate, netIds.getEntity(candidate.id), encoder);
+			// the first one always goes, or an entity bigger than the budget would never be sent
+			candidate.deferred = anySent && used + candidate.size > view.byteBudget;
+			missed |= candidate.deferred;
+			if(!candidate.deferred) {
+				used += candidate.size;
+				anySent = true;
+			}
+		}
+	}
+
+	/* Finds the components and whether the shape candidate would send */
+	void selectCandidateContent(const MergedSnapshot& merged, Candidate& candidate, flecs::entity entity) const {
+		candidate.components = 0;
+		if(candidate.kind == Candidate::CHANGED) {
+			for(const ComponentSnapshot& componentData : merged.componentData) {
+				const ComponentMask* mask = componentData.toUpdate.find(candidate.id);
+				if(mask)
+					candidate.components |= *mask;
+			}
+		} else {
+			candidate.components = getComponentMask(entity);
+		}
+
+		const ShapeComponent* shapeComp = entity.get<ShapeComponent>();
+		candidate.withShape = shapeComp && shapeComp->isValid() && (candidate.kind != Candidate::CHANGED || isShapeInMerged(merged, shapeComp->shape));
+	}
+
+	/* Serializes what candidate would send to find its size */
+	size_t measureCandidate(const Candidate& candidate, flecs::entity entity, SnapshotEncoder& encoder) {
+		size_t size = 2; // the id
+		if(candidate.kind == Candidate::ENTERED)
+			size += std::bitset<maxComponents>(candidate.components).count(); // the adds
+
+		MessageBuffer& scratch = encoder.client.measureBuffer;
+		scratch.clear();
+		Serializer ser = startSerialize(scratch);
+
+		forEachComponent(candidate.components, [&](CompId compId) {
+			const ComponentInfo& info = registeredComponents.find(compId)->second;
+			if(info.ser)
+				info.ser(ser, &entity, 1);
+		});
+
+		if(candidate.withShape)
+			serializeShape(ser, entity.get<ShapeComponent>()->shape);
+
+		ser.adapter().flush();
+		return size + ser.adapter().writtenBytesCount();
+	}
+
+	bool isShapeInMerged(const MergedSnapshot& merged, PhysicsId shapeId) const {
+		ShapeEnum type = getPhysicsWorld().getShape(shapeId).getType();
+		auto it = merged.physicsSnapshot.bodiesToUpdate.find(type);
+		return it != merged.physicsSnapshot.bodiesToUpdate.end() && std::binary_search(it->second.begin(), it->second.end(), shapeId);
+	}
+
+	bool hasMergedChanges(const MergedSnapshot& merged, EntityId id, flecs::entity entity) const {
+		for(const ComponentSnapshot& componentData : merged.componentData)
+			if(componentData.toUpdate.contains(id))
+				return true;
+
+		const ShapeComponent* shapeComp = entity.get<ShapeComponent>();
+		return shapeComp && shapeComp->isValid() && isShapeInMerged(merged, shapeComp->shape);
+	}
+
+	/* Copies entity's changes from merged into filtered */
+	void addMergedChanges(const MergedSnapshot& merged, MergedSnapshot& filtered, EntityId id, flecs::entity entity) {
+		for(size_t piority = 0; piority < merged.componentData.size(); piority++) {
+			const ComponentMask* mask = merged.componentData[piority].toUpdate.find(id);
+			if(mask)
+				filtered.componentData[piority].toUpdate[id] = *mask;
+		}
+
+		const ShapeComponent* shapeComp = entity.get<ShapeComponent>();
+		if(shapeComp && shapeComp->isValid() && isShapeInMerged(merged, shapeComp->shape))
+			filtered.physicsSnapshot.bodiesToUpdate[getPhysicsWorld().getShape(shapeComp->shape).getType()].push_back(shapeComp->shape);
+	}
+
+	/* Adds everything a client needs to create entity, with the network id id, from scratch */
+	void addWholeEntity(MergedSnapshot& snapshot, EntityId id, flecs::entity entity) {
+		snapshot.metaData.spawnEntities[id] = netIds.getGeneration(id);
+
+		const ComponentMask has = getComponentMask(entity);
+		if(has)
+			snapshot.metaData.toAdd[id] = has;
+
+		if(!entity.enabled())
+			snapshot.metaData.toUpdateActive[id] = MetaDataSnapshot::DO_DISABLE;
+
+		addEntityValues(snapshot, id, entity);
+	}
+
+	/* Adds the current value of all of entity's components and its shape */
+	void addEntityValues(MergedSnapshot& snapshot, EntityId id, flecs::entity entity) {
+		for(auto& pair : registeredComponents) {
+			if(pair.second.ser && entity.has(pair.first))
+				snapshot.componentData[(int)pair.second.piority].toUpdate[id] |= pair.second.getBit();
+		}
+
+		const ShapeComponent* shapeComp = entity.get<ShapeComponent>();
+		if(shapeComp && shapeComp->isValid())
+			snapshot.physicsSnapshot.bodiesToUpdate[getPhysicsWorld().getShape(shapeComp->shape).getType()].push_back(shapeComp->shape);
+	}
+
+	bool isInFilter(EntityId id) const {
+		return !interestFilter || std::binary_search(interestFilter->begin(), interestFilter->end(), id);
+	}
+
+	// the network id entity's changes are recorded under, 0 if they are not recorded
+	EntityId getRecordedId(flecs::entity entity) const {
+		return assignsNetIds ? netIds.find(entity) : impl::NetIdTable::invalid;
+	}
 
-				physicsWorld.getShape(id).markLocalDirty();
-			});
+	/* Records everything entity has as changed, for an entity that just became networked */
+	void recordWholeEntity(EntityId id, flecs::entity entity) {
+		deltaSnapshot.metaData.spawnEntities[id] = netIds.getGeneration(id);
 
-		}
-		if (flags & impl::COMPONENT_UPDATE_SNAPSHOT) {
-			deserializeArchetypes(des, [&](Deserializer& des, flecs::entity entity, CompId compId) {
-				registeredComponents[compId].des(des, entity.get_mut((u64)compId));
-			});
+		const ComponentMask has = getComponentMask(entity);
+		if(has)
+			deltaSnapshot.needAdd(id, has);
+
+		for(auto& pair : registeredComponents) {
+			if(pair.second.ser && entity.has(pair.first))
+				deltaSnapshot.needUpdate(id, pair.second.getBit(), pair.second.piority);
 		}
 
-		entityWorld.enable_range_check(true);
+		if(!entity.enabled())
+			deltaSnapshot.needActive(id, MetaDataSnapshot::DO_DISABLE);
 	}
 
-public:
-	/**
-	 * @brief Creates a full snapshot of the world
+	/*
+	 * Client side, binds id to a new entity unless it already has one of generation. An entity left over
+	 * from an older generation of id is destroyed, so its components can't leak into the new one.
 	 */
-	void createFullSnapshot(MessageBuffer& buffer) {
-		auto& world = getEntityWorld();
-		auto& physicsWorld = getPhysicsWorld();
-
-		for(auto system : fullSnapshotSystems) {
-			world.system(system).run(0.0f);
+	void spawnNetEntity(Deserializer& des, EntityId id, u8 generation) {
+		if(id == impl::NetIdTable::invalid || id > impl::NetIdTable::maxNetId) {
+			des.adapter().error(bitsery::ReaderError::InvalidData);
+			return;
 		}
 
-		Serializer ser = startSerialize(buffer);
-		ser.object(MESSAGE_HEADER_FULL_SNAPSHOT);
-		ser.object(getCurrentStateId());
-		sortByArchetypes(fullSnapshot.tags);
-		serializeArchetypes(ser, cache.archetypeMap, nullptr);
-		sortByArchetypes(fullSnapshot.components);
-		serializeArchetypes(ser, cache.archetypeMap, [&](Serializer& ser, EntityId entityId, CompId compId) {
-			flecs::entity entity = impl::af(entityId);
+		flecs::entity entity = netIds.getEntity(id);
+		if(entity.is_valid() && netIds.getGeneration(id) != generation) {
+			entity.destruct();
+			netIds.unbind(id);
+		}
 
-			registeredComponents[compId].ser(ser, entity.get(compId));
-		});
-		serializePhysicsMap(ser, fullSnapshot.physicsSnapshot.bodiesToUpdate, [&](Serializer& ser, ShapeEnum shapeEnum, PhysicsId id) {
-			switch (shapeEnum) {
-			case ShapeEnum::Circle:
-				ser.object(physicsWorld.getCircle((u32)id));
-				break;
-			case ShapeEnum::Polygon:
-				ser.object(physicsWorld.getPolygon((u32)id));
-				break;
+		getOrCreateNetEntity(id);
+		netIds.setGeneration(id, generation);
+	}
 
-			default:
-				assert(!"Invalid shape enum");
-				break;
-			}
-		});
-		endSerialize(ser, buffer);
+	/* Client side, the entity snapshots refer to as id, created the first time it is mentioned */
+	flecs::entity getOrCreateNetEntity(EntityId id) {
+		flecs::entity entity = netIds.getEntity(id);
+		if(!entity.is_valid()) {
+			entity = getEntityWorld().entity();
+			netIds.bind(id, entity);
+		}
 
-		fullSnapshot.resetAll();
+		return entity;
 	}
 
-	/**
-	 * @brief Updates the games current state with a full snapshot.
-	 * This will delete all networked entities and then reconstruct
-	 * the world according to the message.
-	 */
-	void updateWithFullSnapshot(Deserializer& des) {
-		flecs::world& entityWorld = getEntityWorld();
-		PhysicsWorld& physicsWorld = getPhysicsWorld();
+private: /* Cache things */
+	struct Cache {
+		// client side, the archetype being read
+		std::vector<CompId> archetypeComponents;
+		std::vector<flecs::entity> archetypeEntities;
+	} cache;
 
-		entityWorld.enable_range_check(false);
+	/* The components of mask entity has */
+	ComponentMask getComponentMask(flecs::entity entity, ComponentMask mask) const {
+		ComponentMask has = 0;
+		forEachComponent(mask, [&](CompId compId) {
+			if(entity.has(compId))
+				has |= registeredComponents.find(compId)->second.getBit();
+		});
 
-		entityWorld.delete_with<NetworkedEntity>();
+		return has;
+	}
 
-		u64 stateId;
-		des.object(stateId);
-		transitionState(stateId, true);
+	/* All the registered components entity has, walks the entity's own type instead of testing every component */
+	ComponentMask getComponentMask(flecs::entity entity) const {
+		ComponentMask has = 0;
+		entity.each([&](flecs::id comp) {
+			if(comp.is_pair() || comp.raw_id() > std::numeric_limits<CompId>::max())
+				return;
 
-		deserializeArchetypes(des, [](Deserializer& des, flecs::entity entity, CompId compId) {
-			entity.add(compId);
+			auto it = registeredComponents.find((CompId)comp.raw_id());
+			if(it != registeredComponents.end())
+				has |= it->second.getBit();
 		});
-		deserializeArchetypes(des, [&](Deserializer& des, flecs::entity entity, CompId compId) {
-			registeredComponents[compId].des(des, entity.get_mut((u64)compId));
-		});
-		deserializePhysicsMap(des, [&](Deserializer& des, ShapeEnum shapeEnum, PhysicsId shortId) {
-			u32 id = (u32)shortId;
-
-			switch (shapeEnum) {
-			case ShapeEnum::Circle:
-				if (physicsWorld.doesShapeExist(id))
-					des.object(physicsWorld.getCircle(id));
-				else
-					des.object(physicsWorld.getCircle(physicsWorld.insertShape<Circle>(id)));
-				break;
-			case ShapeEnum::Polygon:
-				if (physicsWorld.doesShapeExist(id))
-					des.object(physicsWorld.getPolygon(id));
-				else
-					des.object(physicsWorld.getPolygon(physicsWorld.insertShape<Polygon>(id)));
-				break;
 
-			default:
-				assert(!"Invalid shape enum");
-				break;
-			}
+		return has;
+	}
 
-			physicsWorld.getShape(id).markLocalDirty();
-		});
-	
-		entityWorld.enable_range_check(true);
+	/* Calls f(CompId) for every component in mask, in ComponentInfo::index order */
+	template<typename F>
+	void forEachComponent(ComponentMask mask, F&& f) const {
+		mask &= componentIds.size() < maxComponents ? (ComponentMask(1) << componentIds.size()) - 1 : ~ComponentMask(0);
+		while(mask) {
+			f(componentIds[impl::countTrailingZeros(mask)]);
+			mask &= mask - 1;
+		}
 	}
 
-private: /* Cache things */
-	struct Cache {
-		// used when reversing maps. Helps sort entities by
-		// components to update, allowing for smaller message size.
-		Map<std::set<CompId>, std::vector<EntityId>> archetypeMap;
-	} cache;
 private: // Serialization and deserialization helper functions.
-	Map<std::set<CompId>, std::vector<EntityId>>& sortByArchetypes(const Map<EntityId, Set<CompId>>& entityMap) {
-		cache.archetypeMap.clear();
+	// groups the entities of entityMap by their components into encoder.archetypeMap, for serializeArchetypes()
+	void sortByArchetypes(SnapshotEncoder& encoder, const EntityTable<ComponentMask>& entityMap) {
+		for(auto& pair : encoder.archetypeMap)
+			pair.second.clear();
+
+		entityMap.forEach([&](EntityId id, ComponentMask mask) {
+			if(mask)
+				encoder.archetypeMap[mask].push_back(id);
+		});
+	}
 
-		for(auto& pair : entityMap) {
-			cache.archetypeMap[pair.second].push_back(pair.first);
-		}
+	/*
+	 * Every archetype of encoder.archetypeMap is written as its component mask, its entity ids and, if writeColumn
+	 * is not nullptr, a column per component: writeColumn(Serializer&, const std::vector<flecs::entity>&, CompId) writes
+	 * that component of every entity. Writing by column keeps the per component dispatch out of the entity loop.
+	 */
+	template<typename F>
+	void serializeArchetypes(Serializer& ser, SnapshotEncoder& encoder, F&& writeColumn) {
+		Map<ComponentMask, std::vector<EntityId>>& archetypes = encoder.archetypeMap;
 
-		return cache.archetypeMap;
-	}
+		ListSize archetypeCount = 0;
+		for(auto& archetype : archetypes)
+			archetypeCount += !archetype.second.empty();
 
-	void serializeArchetypes(Serializer& ser, Map<Set<CompId>, std::vector<EntityId>>& archetypes, const std::function<void(Serializer&, EntityId, CompId)>& serCompFunc) {
-		ser.object(static_cast<ListSize>(archetypes.size()));
+		serializeVarint(ser, archetypeCount);
 		for(auto& archetype : archetypes) {
-			serializeSet(ser, archetype.first); // Component Types
-			serializeEntityComponents(ser, archetype.second, archetype.first, serCompFunc); // Entity Types
-		}
-	}
+			if(archetype.second.empty())
+				continue;
 
-	void serializeEntityComponents(Serializer& ser, const std::vector<EntityId>& entities, const Set<CompId>& components, const std::function<void(Serializer&, EntityId, CompId)>& serCompFunc) {
-		ser.object(static_cast<ListSize>(entities.size()));
-		for(auto entity : entities) {
-			ser.object(entity);
+			// the components as a mask of wire indices, the columns follow in wire index order
+			const ComponentMask wireMask = toWireMask(archetype.first);
+			std::vector<CompId>& components = encoder.archetypeComponents;
+			components.clear();
+			for(ComponentMask bits = wireMask; bits; bits &= bits - 1)
+				components.push_back(wireComponentIds[impl::countTrailingZeros(bits)]);
 
-			if(serCompFunc)
-				for(auto comp : components) {
-					serCompFunc(ser, entity, comp);
-				}
+			ser.ext8b(wireMask, bitsery::ext::CompactValue{}); // Component Types
+			// entities must be in ascending order, which sortByArchetypes() guarantees as it walks an EntityTable
+			serializeSortedIds(ser, archetype.second); // Entity Types
+
+			if constexpr (!std::is_same_v<std::decay_t<F>, std::nullptr_t>) {
+				std::vector<flecs::entity>& entities = encoder.archetypeEntities;
+				entities.clear();
+				for(EntityId id : archetype.second)
+					entities.push_back(netIds.getEntity(id));
+
+				for(CompId compId : components)
+					writeColumn(ser, entities, compId);
+			}
 		}
 	}
 
-	void deserializeArchetypes(Deserializer& des, const std::function<void(Deserializer& des, flecs::entity, CompId)>& callback) {
+	/* readColumn(Deserializer&, const std::vector<flecs::entity>&, CompId) is called for every column, see serializeArchetypes() */
+	template<typename F>
+	void deserializeArchetypes(Deserializer& des, F&& readColumn) {
 		ListSize archetypeCount;
-		des.object(archetypeCount);
+		deserializeVarint(des, archetypeCount);
 
-		std::vector<CompId> comps;
+		std::vector<CompId>& comps = cache.archetypeComponents;
+		std::vector<flecs::entity>& entities = cache.archetypeEntities;
 		for (ListSize archetypeI = 0; archetypeI < archetypeCount; archetypeI++) {
-			deserializeVector<CompId>(des, comps); // although serialized as a set, sets and vectors follow the same encoding
-			deserializeEntityComponents(des, comps, callback);
+			ComponentMask wireMask = 0;
+			des.ext8b(wireMask, bitsery::ext::CompactValue{});
+			if(wireComponentIds.size() < maxComponents && (wireMask >> wireComponentIds.size()) != 0) {
+				des.adapter().error(bitsery::ReaderError::InvalidData);
+				return;
+			}
+
+			comps.clear();
+			for(ComponentMask bits = wireMask; bits; bits &= bits - 1)
+				comps.push_back(wireComponentIds[impl::countTrailingZeros(bits)]);
+
+			entities.clear();
+			deserializeSortedIds<EntityId>(des, [&](EntityId id) {
+				if(id == impl::NetIdTable::invalid || id > impl::NetIdTable::maxNetId) {
+					des.adapter().error(bitsery::ReaderError::InvalidData);
+					return;
+				}
+
+				entities.push_back(getOrCreateNetEntity(id));
+			});
+
+			if(des.adapter().error() != bitsery::ReaderError::NoError)
+				return;
+
+			for (CompId compId : comps)
+				readColumn(des, entities, compId);
 		}
 	}
 
-	void deserializeEntityComponents(Deserializer& des, const std::vector<CompId>& comps, const std::function<void(Deserializer& des, flecs::entity, CompId)>& callback) {
-		ListSize entityCount;
-		des.object(entityCount);
+	void deserializeComponentColumn(Deserializer& des, const std::vector<flecs::entity>& entities, CompId compId) {
+		auto it = registeredComponents.find(compId);
+		if (it == registeredComponents.end() || !it->second.des) {
+			des.adapter().error(bitsery::ReaderError::InvalidData);
+			return;
+		}
+
+		it->second.des(des, entities.data(), entities.size());
+	}
 
-		for (ListSize entityI = 0; entityI < entityCount; entityI++) {
-			EntityId rawId;
-			des.object(rawId);
-			flecs::entity entity = getEntityWorld().ensure(rawId);
+	void serializeShape(Serializer& ser, PhysicsId id) {
+		getPhysicsWorld().visitShape((u32)id, [&](auto& shape) {
+			ser.object(shape);
+		});
+	}
 
-			assert(entity.id() != 0);
+	void deserializeShape(Deserializer& des, ShapeEnum shapeEnum, PhysicsId shortId) {
+		PhysicsWorld& physicsWorld = getPhysicsWorld();
+		u32 id = (u32)shortId;
 
-			for (CompId compId : comps) {
-				callback(des, entity, compId);
+		if (physicsWorld.doesShapeExist(id)) {
+			// physics ids are never reused with another type, the snapshot is corrupt or does not belong to this world
+			if (physicsWorld.getShape(id).getType() != shapeEnum) {
+				des.adapter().error(bitsery::ReaderError::InvalidData);
+				return;
 			}
+		} else {
+			physicsWorld.insertShape(id, shapeEnum);
 		}
+
+		physicsWorld.visitShape(id, [&](auto& shape) {
+			des.object(shape);
+		});
+
+		physicsWorld.getShape(id).markLocalDirty();
 	}
 
-	void serializePhysicsMap(Serializer& ser, const Map<ShapeEnum, std::vector<PhysicsId>>& physicsMap, const std::function<void(Serializer&, ShapeEnum, PhysicsId)>& serFunc) {
-		assert(serFunc);
-		
-		ser.object(static_cast<ListSize>(physicsMap.size()));
-		for(auto& pair : physicsMap) {
-			ser.object(pair.first);
+	// sorts the id lists in place so they can be delta encoded
+	template<typename F>
+	void serializePhysicsMap(Serializer& ser, Map<ShapeEnum, std::vector<PhysicsId>>& physicsMap, F&& serFunc) {
+		ListSize groupCount = 0;
+		for (auto& pair : physicsMap) {
+			std::sort(pair.second.begin(), pair.second.end());
+			pair.second.erase(std::unique(pair.second.begin(), pair.second.end()), pair.second.end());
+			groupCount += !pair.second.empty();
+		}
 
-			ser.object(static_cast<ListSize>(pair.second.size()));
-			for(PhysicsId id : pair.second) {
-				ser.object(id);
+		serializeVarint(ser, groupCount);
+		for(auto& pair : physicsMap) {
+			if (pair.second.empty())
+				continue;
 
+			ser.object(pair.first);
+			serializeSortedIds(ser, pair.second, [&](PhysicsId id) {
 				serFunc(ser, pair.first, id);
-			}
+			});
 		}
 	}
 
-	void deserializePhysicsMap(Deserializer& des, const std::function<void(Deserializer& des, ShapeEnum, PhysicsId id)>& callback) {
+	template<typename F>
+	void deserializePhysicsMap(Deserializer& des, F&& callback) {
 		ListSize enumCount;
-		des.object(enumCount);
+		deserializeVarint(des, enumCount);
 
 		for (ListSize enumI = 0; enumI < enumCount; enumI++) {
 			ShapeEnum shapeEnum;
 			des.object(shapeEnum);
+			if (shapeEnum >= ShapeEnum::Invalid) {
+				des.adapter().error(bitsery::ReaderError::InvalidData);
+				return;
+			}
 
-			ListSize idCount;
-			des.object(idCount);
-			for (ListSize idI = 0; idI < idCount; idI++) {
-				PhysicsId id;
-				des.object(id);
-
+			deserializeSortedIds<PhysicsId>(des, [&](PhysicsId id) {
 				callback(des, shapeEnum, id);
-			}
+			});
 		}
 	}
 
-	template<typename MapType>
-	void serializeMap(Serializer& ser, const MapType& map) {
-		ser.object(static_cast<ListSize>(map.size()));
-		for (auto& pair : map) {
-			ser.object(pair.first);
-			ser.object(pair.second);
+	/* Ids and counts are written as varints, anything below 128 takes a single byte */
+	template<typename T>
+	static void serializeVarint(Serializer& ser, T value) {
+		static_assert(std::is_unsigned_v<T> && sizeof(T) == 4);
+		ser.ext4b(value, bitsery::ext::CompactValue{});
+	}
+
+	template<typename T>
+	static void deserializeVarint(Deserializer& des, T& value) {
+		static_assert(std::is_unsigned_v<T> && sizeof(T) == 4);
+		des.ext4b(value, bitsery::ext::CompactValue{});
+	}
+
+	/*
+	 * Writes ascending unique ids as a count followed by the gap before each id, so runs of
+	 * dense ids cost a byte each. afterEach(id) is called after every id to write its payload.
+	 */
+	template<typename Container, typename F>
+	static void serializeSortedIds(Serializer& ser, const Container& ids, F&& afterEach) {
+		serializeVarint(ser, static_cast<ListSize>(ids.size()));
+
+		u32 next = 0;
+		for (auto id : ids) {
+			assert(id >= next && "ids must be unique and in ascending order");
+
+			serializeVarint(ser, (u32)(id - next));
+			next = (u32)id + 1;
+
+			afterEach(id);
 		}
 	}
 
-	template<typename F, typename S>
-	void deserializeMap(Deserializer& des, const std::function<void(F, S)>& callback) {
+	template<typename Container>
+	static void serializeSortedIds(Serializer& ser, const Container& ids) {
+		serializeSortedIds(ser, ids, [](auto) {});
+	}
+
+	template<typename T, typename F>
+	static void deserializeSortedIds(Deserializer& des, F&& callback) {
 		ListSize size;
-		des.object(size);
+		deserializeVarint(des, size);
+
+		u32 next = 0;
 		for (ListSize i = 0; i < size; i++) {
-			F first;
-			S second;
-			des.object(first);
-			des.object(second);
-			callback(first, second);
+			u32 gap;
+			deserializeVarint(des, gap);
+
+			T id = (T)(next + gap);
+			next = (u32)id + 1;
+
+			callback(id);
 		}
 	}
 
-	template<typename T>
-	void serializeSet(Serializer& ser, const std::set<T>& list) {
-		ser.object(static_cast<ListSize>(list.size()));
-		for (auto& value : list) {
-			ser.object(value);
-		}
+	// read back by updateWithFullSnapshot()
+	void serializeFullSnapshotHeader(Serializer& ser) {
+		ser.object(MESSAGE_HEADER_FULL_SNAPSHOT);
+		serializeVarint(ser, sequence);
+		ser.ext8b(getCurrentTick(), bitsery::ext::CompactValue{});
+		ser.object(getCurrentStateId());
 	}
 
+	// the ids are delta encoded, read back with deserializeMap()
 	template<typename T>
-	void deserializeSet(Deserializer& des, const std::function<void(T)>& callback) {
-		ListSize size;
-		des.object(size);
-		for (ListSize i = 0; i < size; i++) {
-			T object;
-			des.object(object);
-			callback(object);
-		}
+	void serializeTable(Serializer& ser, const EntityTable<T>& table) {
+		serializeSortedIds(ser, table.getIds(), [&](EntityId id) {
+			ser.object(*table.find(id));
+		});
+	}
+
+	template<typename K, typename V, typename F>
+	void deserializeMap(Deserializer& des, F&& callback) {
+		deserializeSortedIds<K>(des, [&](K first) {
+			V second;
+			des.object(second);
+			callback(first, second);
+		});
+	}
+
+	template<typename T, typename F>
+	void deserializeSet(Deserializer& des, F&& callback) {
+		deserializeSortedIds<T>(des, callback);
 	}
 
 	template<typename T>
 	void serializeVector(Serializer& ser, const std::vector<T>& list) {
-		ser.object(static_cast<ListSize>(list.size()));
+		serializeVarint(ser, static_cast<ListSize>(list.size()));
 		for (auto& value : list) {
 			ser.object(value);
 		}
 	}
 
-	template<typename T>
-	void deserializeVector(Deserializer& des, const std::function<void(T)>& callback) {
+	template<typename T, typename F>
+	void deserializeVector(Deserializer& des, F&& callback) {
 		ListSize size;
-		des.object(size);
+		deserializeVarint(des, size);
 		for (ListSize i = 0; i < size; i++) {
 			T object;
 			des.object(object);
@@ -1310,7 +3432,7 @@ private: // Serialization and deserialization helper functions.
 	template<typename T>
 	void deserializeVector(Deserializer& des, std::vector<T>& vector) {
 		ListSize size;
-		des.object(size);
+		deserializeVarint(des, size);
 		vector.resize(size);
 		for (ListSize i = 0; i < size; i++) {
 			des.object(vector[i]);
@@ -1319,12 +3441,25 @@ private: // Serialization and deserialization helper functions.
 
 private:
 	struct ComponentInfo {
+		// a whole archetype column per call, so the loop over the entities is compiled for the component type
+		using SerializeColumn = void(*)(Serializer& ser, const flecs::entity* entities, size_t count);
+		using DeserializeColumn = void(*)(Deserializer& des, const flecs::entity* entities, size_t count);
+
+		NODISCARD ComponentMask getBit() const { return ComponentMask(1) << index; }
+
 		ComponentPiority piority;
-		std::function<void(Serializer& ser, const void* CompData)> ser;
-		std::function<void(Deserializer& ser, void* CompData)> des;
+		u8 index = 0; // in registration order, see ComponentMask
+		u8 wireIndex = 0; // in name order, what snapshots use, see updateSchema()
+		std::string name;
+		SerializeColumn ser = nullptr; // nullptr for tags
+		DeserializeColumn des = nullptr;
 	};
 
 	Map<CompId, ComponentInfo> registeredComponents;
+	std::vector<CompId> componentIds; // by ComponentInfo::index
+	std::vector<CompId> wireComponentIds; // by ComponentInfo::wireIndex
+	u64 componentSchemaHash = 0; // see updateSchema(), getSchemaHash() adds the quantization
+	QuantizationSettings quantization;
 
 	struct MetaDataSnapshot {
 		enum ActiveFlags : u8 {
@@ -1335,16 +3470,17 @@ private:
 		
 		bool canSerialize() const {
 			return !removeEntities.empty() ||
+				   !spawnEntities.empty() ||
 				   !toRemove.empty() ||
 				   !toAdd.empty() ||
 				   !toUpdateActive.empty();
 		}
 
-		Set<EntityId> removeEntities;
-		Map<EntityId, std::pair<u32, bool>> currentGens;
-		Map<EntityId, Set<CompId>> toRemove;
-		Map<EntityId, Set<CompId>> toAdd;
-		Map<EntityId, u8> toUpdateActive;
+		EntitySet removeEntities;
+		EntityTable<u8> spawnEntities; // new to the client, with the generation of their network id
+		EntityTable<ComponentMask> toRemove;
+		EntityTable<ComponentMask> toAdd;
+		EntityTable<u8> toUpdateActive;
 	};
 
 	struct ComponentSnapshot {
@@ -1352,24 +3488,29 @@ private:
 			return !toUpdate.empty();
 		}
 
-		Map<EntityId, Set<CompId>> toUpdate;
+		EntityTable<ComponentMask> toUpdate;
 	};
 
 	struct PhysicsSnapshot {
 		bool canSerialize() const {
-			return !bodiesToUpdate.empty();
+			// resetAll() keeps the per-type vectors around, so check their contents
+			for (auto& pair : bodiesToUpdate)
+				if (!pair.second.empty())
+					return true;
+
+			return false;
 		}
 
 		Map<ShapeEnum, std::vector<PhysicsId>> bodiesToUpdate;
 	};
 
 	/*
-	 * Assuming the client's state is the same as the previous
-	 * server state (last tick), what is the minimal amount of
-	 * data that needs to be sent to get from Point A to Point B?
-	 *
-	 * Point A: the previous tick.
-	 * Point B: this tick.
+	 * Records what changed since the last sealed snapshot.
+	 * sealSnapshot() moves the recorded changes into snapshotHistory.
+	 * 
+	 * This runs on every networked component write, so it is kept free of allocations: changes are
+	 * component masks in EntityTables, which keep their pages and lists when cleared and are swapped
+	 * with the oldest frame when sealed.
 	 */
 	struct DeltaCompressedSnapshot {
 		DeltaCompressedSnapshot() {
@@ -1395,76 +3536,44 @@ private:
 			});
 		}
 
-		void needUpdate(flecs::entity entity, CompId id, Map<CompId, ComponentInfo>& infos) {
-			tryIncreaseGen(entity);
-
-			// is the entity currently destroyed?
-			// When an entity is destroyed and utilizes prefabs
-			// OnSet is called on whatever component is overriden and removed
-			if(metaData.currentGens[entity].second)
-				return;
-
-			componentData[(int)infos[id].piority].toUpdate[impl::cf<EntityId>(entity)].insert(id);
-		}
-
-		void needAdd(flecs::entity entity, CompId id) {
-			tryIncreaseGen(entity);
-			metaData.toAdd[impl::cf<EntityId>(entity)].insert(id);
+		// the ids are network ids, an entity that is being destroyed has none anymore, see getRecordedId()
+		void needUpdate(EntityId id, ComponentMask bit, ComponentPiority piority) {
+			componentData[(int)piority].toUpdate[id] |= bit;
 		}
 
-		void needRemove(flecs::entity entity, CompId id) {
-			tryIncreaseGen(entity);
-			metaData.toRemove[impl::cf<EntityId>(entity)].insert(id);
+		void needAdd(EntityId id, ComponentMask bit) {
+			metaData.toAdd[id] |= bit;
 		}
 
-		void needActive(flecs::entity entity, MetaDataSnapshot::ActiveFlags flags) {
-			tryIncreaseGen(entity);
-			metaData.toUpdateActive[impl::cf<EntityId>(entity)] = flags;
+		void needRemove(EntityId id, ComponentMask bit) {
+			metaData.toRemove[id] |= bit;
 		}
 
-		void tryIncreaseGen(flecs::entity entity) {
-			assert(entity.is_alive());
-
-			u32 idOnly = impl::cf<EntityId>(entity);
-			u32 newGen = ECS_GENERATION(entity.id());
-
-			if (metaData.currentGens.find(idOnly) == metaData.currentGens.end()) {
-				metaData.currentGens[idOnly].first = newGen;
-				metaData.currentGens[idOnly].second = false;
-				return;
-			}
-
-			if (metaData.currentGens[idOnly].first != newGen) {
-				resetEntity(idOnly);
-				metaData.removeEntities.insert(idOnly);
-				metaData.currentGens[idOnly].first = newGen;
-				metaData.currentGens[idOnly].second = false;
-			}
+		void needActive(EntityId id, MetaDataSnapshot::ActiveFlags flags) {
+			metaData.toUpdateActive[id] = flags;
 		}
 
 		void resetEntity(EntityId id) {
 			componentData[(int)ComponentPiority::High].toUpdate.erase(id);
 			componentData[(int)ComponentPiority::Low].toUpdate.erase(id);
+			metaData.spawnEntities.erase(id);
 			metaData.toRemove.erase(id);
 			metaData.toAdd.erase(id);
 			metaData.toUpdateActive.erase(id);
 		}
 
 		void resetAll() {
-			metaData.currentGens.clear();
 			metaData.removeEntities.clear();
+			metaData.spawnEntities.clear();
 			componentData[(int)ComponentPiority::High].toUpdate.clear();
 			componentData[(int)ComponentPiority::Low].toUpdate.clear();
 			metaData.toRemove.clear();
 			metaData.toAdd.clear();
 			metaData.toUpdateActive.clear();
-			physicsSnapshot.bodiesToUpdate[ShapeEnum::Circle].clear();
-			physicsSnapshot.bodiesToUpdate[ShapeEnum::Polygon].clear();
+			for (auto& pair : physicsSnapshot.bodiesToUpdate)
+				pair.second.clear();
 		}
 
-		/* What data is inside this snapshot? */
-		u8 flags;
-
 		/* What state was active between server ticks? */
 		u64 state;
 
@@ -1481,27 +3590,287 @@ private:
 		flecs::query<ShapeComponent> shapeCompQuery;
 	} deltaSnapshot;
 
+	/* The changes recorded between two network updates */
+	struct SnapshotFrame {
+		// several encoders may read a sealed frame at once, see EntityTable::normalize()
+		void normalize() const {
+			metaData.removeEntities.normalize();
+			metaData.spawnEntities.normalize();
+			metaData.toRemove.normalize();
+			metaData.toAdd.normalize();
+			metaData.toUpdateActive.normalize();
+			for (const ComponentSnapshot& data : componentData)
+				data.toUpdate.normalize();
+		}
+
+		u32 sequence = 0;
+		u64 tick = 0; // the server tick it was sealed at
+		bool stateChanged = false;
+		MetaDataSnapshot metaData;
+		PhysicsSnapshot physicsSnapshot;
+		std::array<ComponentSnapshot, 2> componentData; // use the enum ComponentPiority
+	};
+
+	/* Every frame after a client's baseline folded into one, see mergeSnapshotFrames() */
+	struct MergedSnapshot {
+		void resetAll() {
+			stateChanged = false;
+			touchedComponents.clear();
+			touchedActive.clear();
+			metaData.removeEntities.clear();
+			metaData.spawnEntities.clear();
+			metaData.toAdd.clear();
+			metaData.toRemove.clear();
+			metaData.toUpdateActive.clear();
+			for (auto& pair : physicsSnapshot.bodiesToUpdate)
+				pair.second.clear();
+			for (ComponentSnapshot& data : componentData)
+				data.toUpdate.clear();
+		}
+
+		// what was merged, see mergeSnapshotFrames()
+		u32 baseline = 0;
+		u32 sequence = 0;
+		u64 tick = 0;
+
+		bool stateChanged = false;
+		EntityTable<ComponentMask> touchedComponents; // added or removed at some point after the baseline
+		EntitySet touchedActive;
+		MetaDataSnapshot metaData;
+		PhysicsSnapshot physicsSnapshot;
+		std::array<ComponentSnapshot, 2> componentData; // use the enum ComponentPiority
+	};
+
+	/* An entity that has something to send to a client, see filterMergedSnapshot() */
+	struct Candidate {
+		enum Kind : u8 {
+			ENTERED, // the client does not have it
+			OWED, // its changes were deferred by an earlier snapshot, everything is resent
+			CHANGED
+		};
+
+		EntityId id;
+		Kind kind;
+		bool deferred = false;
+		bool withShape = false;
+		ComponentMask components = 0;
+		float score = 0.0f;
+		size_t size = 0;
+	};
+
+	struct ClientScratch {
+		EntityIdList relevant;
+		EntityIdList known;
+		EntityIdList owed;
+		bool complete = false;
+		std::vector<Candidate> candidates;
+		MessageBuffer measureBuffer;
+	};
+
+public:
+	/*
+	 * The scratch memory snapshots are created with. Snapshots for different clients can be created on
+	 * different threads at the same time, as long as every thread has its own encoder and nothing changes
+	 * the world or seals a snapshot meanwhile. See ServerInterface::setEncodingThreads().
+	 */
+	class SnapshotEncoder {
+	private:
+		friend class NetworkStateManager;
+
+		MergedSnapshot merged; // see mergeSnapshotFrames()
+		MergedSnapshot filtered; // merged narrowed down to one client's view
+		ClientScratch client;
+
+		// entities sorted by their components, the lists are kept between uses and empty ones are skipped
+		Map<ComponentMask, std::vector<EntityId>> archetypeMap;
+		std::vector<CompId> archetypeComponents;
+		std::vector<flecs::entity> archetypeEntities; // of the archetype being written
+	};
+
+private:
+	SnapshotEncoder encoder; // for everything that is not given one
+
+	PrioritySettings priorities;
+
+	// set while creating a full snapshot for one client's view
+	const EntityIdList* interestFilter = nullptr;
+	flecs::query<> shapelessQuery;
+	flecs::query<> networkedQuery;
+
+	impl::NetIdTable netIds; // of the networked entities, see getNetId()
+	bool assignsNetIds = true; // false client side
+
+	std::vector<SnapshotFrame> snapshotHistory = std::vector<SnapshotFrame>(defaultSnapshotHistoryLength);
+	u32 sequence = 0; // of the last sealed snapshot, 0 is never sealed
+	u32 lastAppliedSequence = 0; // client side, the newest snapshot applied
+	u64 lastAppliedTick = 0; // client side, the server tick of lastAppliedSequence
+	bool hasAppliedFullSnapshot = false; // client side, deltas are useless without one
+
+	struct InputAck {
+		u32 sequence = 0;
+		u64 inputTick = 0;
+	};
+
+	std::array<InputAck, 16> inputAcks; // client side, indexed by snapshot sequence
+
 	/*
 	 * A serialized version of all networked entities and their components.
 	 * Everything is serialized.
 	 */
 	struct FullSnapshot {
 		void resetAll() {
+			spawnEntities.clear();
 			tags.clear();
 			components.clear();
-			physicsSnapshot.bodiesToUpdate[ShapeEnum::Circle].clear();
-			physicsSnapshot.bodiesToUpdate[ShapeEnum::Polygon].clear();
+			for (auto& pair : physicsSnapshot.bodiesToUpdate)
+				pair.second.clear();
 		}
 
-		Map<EntityId, Set<CompId>> tags;
-		Map<EntityId, Set<CompId>> components;
+		EntityTable<u8> spawnEntities; // every entity in it, see MetaDataSnapshot::spawnEntities
+		EntityTable<ComponentMask> tags;
+		EntityTable<ComponentMask> components;
 		PhysicsSnapshot physicsSnapshot;
 	} fullSnapshot;
 
 	std::vector<flecs::entity> allDeltaSnapshotSystems;
 	std::vector<flecs::entity> fullSnapshotSystems;
+
+	struct ApplyCallbacks {
+		u32 id;
+		std::function<void()> beforeApply;
+		std::function<void()> afterApply;
+	};
+
+	std::vector<ApplyCallbacks> applyCallbacks;
+	u32 lastApplyCallbackId = 0;
+};
+
+/**
+ * @brief Client side estimate of the server's clock, kept by ClientInterface.
+ * 
+ * The client pings the server every "pingInterval" seconds, and the server answers with its tick,
+ * including how far into the next tick it is. Assuming the answer took half the round trip, each
+ * answer is a sample of the offset between the local clock and the server's. Samples are smoothed,
+ * and ones with an unusually long round trip are ignored as the extra time was most likely spent
+ * queued in one direction only.
+ * 
+ * The estimate never jumps once synced. Differences from new samples, e.g. from clock drift or a
+ * server that fell behind, are slewed in at "maxSlewRate", unless they are past "snapThreshold".
+ * 
+ * Server time is in seconds, a tick is 1 / tick rate seconds long. Both ends must use the same tick rate.
+ */
+class ServerClock {
+public:
+	static constexpr double defaultPingInterval = 0.5;
+	static constexpr size_t fastPingCount = 5; // pinged four times as often while syncing
+	static constexpr double smoothing = 0.1; // weight of a new sample
+	static constexpr double snapThreshold = 0.25; // seconds
+	static constexpr double maxSlewRate = 0.05; // seconds corrected per second
+
+	void reset() {
+		rtt = 0.0;
+		rttDeviation = 0.0;
+		targetOffset = 0.0;
+		offset = 0.0;
+		sampleCount = 0;
+		lastPing = -1.0;
+		lastUpdate = -1.0;
+	}
+
+	void setPingInterval(double seconds) { pingInterval = seconds; }
+	NODISCARD double getPingInterval() const { return pingInterval; }
+
+	/* Has the server answered a ping yet? Before that every estimate is meaningless */
+	NODISCARD bool isSynced() const { return sampleCount > 0; }
+
+	/* Smoothed round trip time in seconds */
+	NODISCARD double getRtt() const { return rtt; }
+	NODISCARD double getRttDeviation() const { return rttDeviation; }
+
+	NODISCARD double getServerTime() const {
+		return now<double, std::chrono::seconds::period>() + offset;
+	}
+
+	/* The tick the server is currently at, fractional as it is usually part way into the next one */
+	NODISCARD double getServerTick() const {
+		return getServerTime() * impl::getTickRate();
+	}
+
+	/* Is a ping due at time (local seconds)? */
+	NODISCARD bool shouldPing(double time) const {
+		const double interval = sampleCount < fastPingCount ? pingInterval / 4.0 : pingInterval;
+		return lastPing < 0.0 || time - lastPing >= interval;
+	}
+
+	void onPingSent(double time) {
+		lastPing = time;
+	}
+
+	/**
+	 * @param sendTime local time the ping was sent at
+	 * @param receiveTime local time the answer arrived at
+	 * @param serverTime server time when the ping was answered
+	 */
+	void addSample(double sendTime, double receiveTime, double serverTime) {
+		const double sampleRtt = receiveTime - sendTime;
+		if (sampleRtt < 0.0)
+			return;
+
+		const bool outlier = sampleCount >= fastPingCount && sampleRtt > rtt + 4.0 * rttDeviation + 0.005;
+
+		// like TCP, the deviation is updated against the old average
+		if (sampleCount == 0) {
+			rtt = sampleRtt;
+			rttDeviation = sampleRtt / 2.0;
+		} else {
+			rttDeviation += 0.25 * (std::abs(sampleRtt - rtt) - rttDeviation);
+			rtt += 0.125 * (sampleRtt - rtt);
+		}
+
+		if (outlier)
+			return;
+
+		const double sampleOffset = serverTime + sampleRtt / 2.0 - receiveTime;
+
+		// the first samples are averaged evenly, so a bad first sample doesn't linger
+		sampleCount++;
+		const double weight = std::max(1.0 / (double)sampleCount, smoothing);
+		targetOffset = sampleCount == 1 ? sampleOffset : targetOffset + (sampleOffset - targetOffset) * weight;
+
+		if (sampleCount <= fastPingCount || std::abs(targetOffset - offset) > snapThreshold)
+			offset = targetOffset;
+	}
+
+	/* Slews the estimate towards the samples, called every update */
+	void update(double time) {
+		const double elapsed = lastUpdate < 0.0 ? 0.0 : time - lastUpdate;
+		lastUpdate = time;
+
+		const double maxStep = maxSlewRate * elapsed;
+		offset += std::clamp(targetOffset - offset, -maxStep, maxStep);
+	}
+
+private:
+	double pingInterval = defaultPingInterval;
+
+	double rtt = 0.0;
+	double rttDeviation = 0.0;
+	double targetOffset = 0.0; // server time - local time, smoothed samples
+	double offset = 0.0; // what the estimate uses, follows targetOffset
+	size_t sampleCount = 0;
+
+	double lastPing = -1.0;
+	double lastUpdate = -1.0;
 };
 
+namespace impl {
+	inline ServerClock serverClock;
+}
+
+inline ServerClock& getServerClock() {
+	return impl::serverClock;
+}
+
 /* Default network interfaces */
 
 /**
@@ -1513,26 +3882,15 @@ private:
  */
 class ClientInterface : public NetworkInterface {
 public:
-	/* When an entity is by the client, it will start at this range.
-	   I.E. the default client range for created entites. */
-	static constexpr u64 defaultLocalEntityRange = 1000000;
 	static constexpr size_t defaultMaxDsyncBeforeFullSnapshot = 30;
 
+	// networked entities are mapped to the server's by their network ids, so local entities can have any id
 	ClientInterface() {
-		flecs::world& world = getEntityWorld();
-
-		world.set_entity_range(defaultLocalEntityRange, UINT64_MAX);
-		world.enable_range_check(true);
+		getNetworkStateManager().setAssignsNetIds(false);
 	}
 
 	virtual ~ClientInterface() {
-		flecs::world& world = getEntityWorld();
-
-		// this is broken for some reason, i've asked on how to
-		// reset starting ID but no one has responded ;(
-		// https://discord.com/channels/633826290415435777/1210120089517563914/1210120089517563914
-		//world.set_entity_range(0, defaultLocalEntityRange);
-		world.enable_range_check(false);
+		getNetworkStateManager().setAssignsNetIds(true);
 	}
 
 	/**
@@ -1597,16 +3955,71 @@ protected:
 
 	void _internalOnConnectionJoin(HSteamNetConnection newConn) override {
 		connected = true;
+		droppedSnapshots = 0;
+		awaitingFullSnapshot = false;
+		getNetworkStateManager().resetLastAppliedSequence();
+		getServerClock().reset();
+		sendSchema();
+	}
+
+	void _internalUpdate() override {
+		if (!connected)
+			return;
+
+		ServerClock& clock = getServerClock();
+		const double time = now<double, std::chrono::seconds::period>();
+
+		if (clock.shouldPing(time)) {
+			sendTimePing(time);
+			clock.onPingSent(time);
+		}
+
+		clock.update(time);
 	}
 
 	bool _internalOnMessageRecieved(HSteamNetConnection newConn, MessageHeader header, Deserializer& des) override {
+		NetworkStateManager& stateManager = getNetworkStateManager();
+
 		switch (header) {
 		case MESSAGE_HEADER_DELTA_SNAPSHOT:
-			getNetworkStateManager().updateWithDeltaSnapshot(des);
+			if (stateManager.updateWithDeltaSnapshot(des)) {
+				droppedSnapshots = 0;
+				sendSnapshotAck();
+			}
+			// deltas against a full snapshot still on its way are dropped too, those are no desync
+			else if (stateManager.getHasAppliedFullSnapshot() && !awaitingFullSnapshot
+				&& ++droppedSnapshots > defaultMaxDsyncBeforeFullSnapshot) {
+				// the server keeps encoding against a snapshot we never got, start over
+				droppedSnapshots = 0;
+				requestFullSnapshot();
+			}
 			break;
 		case MESSAGE_HEADER_FULL_SNAPSHOT:
-			getNetworkStateManager().updateWithFullSnapshot(des);
+			// full snapshots are reliable, any of them puts us back in step with the server
+			awaitingFullSnapshot = false;
+			droppedSnapshots = 0;
+			if (stateManager.updateWithFullSnapshot(des))
+				sendSnapshotAck();
 			break;
+		case MESSAGE_HEADER_INPUT_ACK: {
+			u32 snapshotSequence = 0;
+			u64 inputTick = 0;
+			des.ext4b(snapshotSequence, bitsery::ext::CompactValue{});
+			des.ext8b(inputTick, bitsery::ext::CompactValue{});
+
+			stateManager.recordInputAck(snapshotSequence, inputTick);
+		} break;
+		case MESSAGE_HEADER_TIME_PONG: {
+			double sendTime = 0.0;
+			u64 serverTick = 0;
+			float tickProgress = 0.0f;
+			des.value8b(sendTime);
+			des.ext8b(serverTick, bitsery::ext::CompactValue{});
+			des.value4b(tickProgress);
+
+			const double serverTime = ((double)serverTick + tickProgress) / impl::getTickRate();
+			getServerClock().addSample(sendTime, now<double, std::chrono::seconds::period>(), serverTime);
+		} break;
 		default:
 			return true;
 		}
@@ -1614,9 +4027,54 @@ protected:
 		return false;
 	}
 
+	/* The server only sends snapshots once it knows we read components the way it writes them */
+	void sendSchema() {
+		MessageBuffer buffer;
+		Serializer ser = startSerialize(buffer);
+		ser.object(MESSAGE_HEADER_SCHEMA);
+		ser.value8b(getNetworkStateManager().getSchemaHash());
+		endSerialize(ser, buffer);
+
+		getNetworkManager().sendMessage(conn, std::move(buffer), false, true);
+	}
+
+	/* Tells the server which snapshot we have, it encodes the next ones against it */
+	void sendSnapshotAck() {
+		MessageBuffer buffer;
+		Serializer ser = startSerialize(buffer);
+		ser.object(MESSAGE_HEADER_SNAPSHOT_ACK);
+		ser.object(getNetworkStateManager().getLastAppliedSequence());
+		endSerialize(ser, buffer);
+
+		getNetworkManager().sendMessage(conn, std::move(buffer), false, false);
+	}
+
+	/* The server answers with its tick, see ServerClock */
+	void sendTimePing(double time) {
+		MessageBuffer buffer;
+		Serializer ser = startSerialize(buffer);
+		ser.object(MESSAGE_HEADER_TIME_PING);
+		ser.value8b(time);
+		endSerialize(ser, buffer);
+
+		getNetworkManager().sendMessage(conn, std::move(buffer), false, false);
+	}
+
+	void requestFullSnapshot() {
+		MessageBuffer buffer;
+		Serializer ser = startSerialize(buffer);
+		ser.object(MESSAGE_HEADER_REQUEST_FULL_SNAPSHOT);
+		endSerialize(ser, buffer);
+
+		getNetworkManager().sendMessage(conn, std::move(buffer), false, true);
+		awaitingFullSnapshot = true;
+	}
+
 protected:
 	bool failed = false;
 	bool connected = false;
+	size_t droppedSnapshots = 0; // in a row
+	bool awaitingFullSnapshot = false; // requested, drops are not counted until it arrives
 	HSteamNetConnection conn = k_HSteamNetConnection_Invalid;
 };
 
@@ -1634,43 +4092,221 @@ public:
 	ServerInterface() {
 		networkUpdate.setRate(20.0f);
 		networkUpdate.setFunction([&](float) { snapshotUpdate(); });
+
+		setEncodingThreads(getDefaultEncodingThreads());
 	}
 
 	virtual ~ServerInterface() = default;
 
 	/**
-	 * @brief Sends the snapshot compilation created within the
-	 * NetworkSnapshotManger and sends it to all clients.
+	 * @brief Seals the changes since the last update into a snapshot and sends every client
+	 * a delta from the last snapshot it acknowledged. Clients sharing a baseline share one encoded
+	 * message. Everything is sent unreliably, a lost snapshot is covered by the next one.
+	 * Clients without a usable baseline are sent a full snapshot instead.
+	 * 
+	 * Clients with a view or a bandwidth limit, see setClientView() and setClientBandwidth(), are
+	 * sent their own snapshot. So are joining clients while the world is streamed to them, see setStreamRate().
+	 * 
+	 * The deltas are encoded in parallel, see setEncodingThreads(), and sent once all of them are done.
 	 */
 	void snapshotUpdate() {
 		NetworkStateManager& stateManager = getNetworkStateManager();
 		NetworkManager& networkManager = getNetworkManager();
-		MessageBuffer reliableSnapshot;
-		MessageBuffer unreliableSnapshot;
 	
-		stateManager.createDeltaSnapshot(reliableSnapshot, unreliableSnapshot);
-	
-		networkManager.sendMessage(0, std::move(reliableSnapshot), true, true);
-		networkManager.sendMessage(0, std::move(unreliableSnapshot), true, false);
+		u32 sequence = stateManager.sealSnapshot();
+
+		// stale now that the sequence moved on, only fullSizeHint is kept so a large world isn't held until the next join
+		if (sharedFullSnapshot.valid && sharedFullSnapshot.sequence != sequence) {
+			sharedFullSnapshot.buffer.reset();
+			sharedFullSnapshot.valid = false;
+		}
+
+		// sent right before the snapshot, so they usually share a packet
+		for (auto& pair : clients) {
+			if (pair.second.hasAppliedInput)
+				sendInputAck(pair.first, sequence, pair.second.appliedInput);
+		}
+
+		baselineGroupCount = 0;
+		clientJobCount = 0;
+		foundWorldEntities = false;
+		fullSyncTargets.clear();
+		for (auto& pair : clients) {
+			ClientSnapshotState& client = pair.second;
+			u32 baseline = client.getBaseline();
+
+			if (!client.schemaMatched)
+				continue;
+
+			if (client.usesOwnSnapshots()) {
+				clientSnapshotUpdate(pair.first, client, sequence);
+				continue;
+			}
+
+			if (!client.synced || !stateManager.canCreateDeltaSnapshot(baseline)) {
+				markFullSynced(client);
+				fullSyncTargets.push_back(pair.first);
+				continue;
+			}
+
+			if (baseline != sequence)
+				getBaselineGroup(baseline).targets.push_back(pair.first);
+		}
+
+		encodeDeltaSnapshots();
+
+		size_t largestDelta = 0;
+		for (size_t i = 0; i < baselineGroupCount; i++) {
+			largestDelta = std::max(largestDelta, baselineGroups[i].snapshot.getSize());
+			networkManager.sendMessage(baselineGroups[i].targets, std::move(baselineGroups[i].snapshot), false);
+		}
+
+		for (size_t i = 0; i < clientJobCount; i++) {
+			largestDelta = std::max(largestDelta, clientJobs[i].snapshot.getSize());
+			networkManager.sendMessage(clientJobs[i].conn, std::move(clientJobs[i].snapshot), false, false);
+		}
+
+		if (largestDelta > 0)
+			deltaSizeHint = largestDelta;
+
+		sendFullSnapshot(fullSyncTargets);
 	}
 
 	/**
 	 * @brief Sends a fullSyncUpdate to "who." This means all currently created
 	 * components, entities, physics objects will be serialized and then sent
 	 * to that connection. This is quite a performance heavy function so use 
-	 * only if requested of the client or when a client joins
+	 * only if requested of the client or when a client joins.
 	 * 
-	 * @param who the client/connection to send the update to
+	 * Clients that have not been sent one are sent one automatically by snapshotUpdate().
+	 * Clients with a view or a bandwidth limit are sent theirs with the next snapshotUpdate(), as it is made for them.
+	 * Clients the world is still streamed to start the stream over instead.
+	 * Every full snapshot sent in the same tick shares one encoding, so many clients joining at once
+	 * cost about as much as one.
+	 * 
+	 * @param who the client/connection to send the update to, 0 for everyone
 	 */
 	void fullSyncUpdate(HSteamNetConnection who) {
-		MessageBuffer fullsnapshot;
+		fullSyncTargets.clear();
+		for (auto& pair : clients) {
+			if (who && pair.first != who)
+				continue;
+
+			// a client that asks before its schema hash matched is synced by snapshotUpdate() once it does
+			if (!pair.second.schemaMatched)
+				continue;
+
+			if (pair.second.usesOwnSnapshots()) {
+				pair.second.synced = false;
+				continue;
+			}
 
-		getNetworkStateManager().createFullSnapshot(fullsnapshot);
+			markFullSynced(pair.second);
+			fullSyncTargets.push_back(pair.first);
+		}
 
-		if(who)
-			getNetworkManager().sendMessage(who, std::move(fullsnapshot), false, true);
-		else
-			getNetworkManager().sendMessage(0, std::move(fullsnapshot), true, true);
+		sendFullSnapshot(fullSyncTargets);
+	}
+
+	/**
+	 * @brief Limits what conn is sent to the networked entities around viewEntity, see
+	 * NetworkStateManager::findRelevantEntities(). Entities are created on the client when they come
+	 * into view and destroyed when they leave it, so bandwidth depends on how crowded the
+	 * area around viewEntity is instead of the size of the world.
+	 * 
+	 * With a radius of 0 the client sees the whole world, but the entities near viewEntity are still
+	 * sent first when its snapshots are limited, see setClientBandwidth() and setStreamRate().
+	 * 
+	 * @param viewEntity a networked entity with a ShapeComponent, usually the client's player
+	 * @param radius half the size of the square around viewEntity that is visible
+	 */
+	void setClientView(HSteamNetConnection conn, flecs::entity viewEntity, float radius) {
+		assert(radius >= 0.0f);
+
+		ClientSnapshotState* client = findClient(conn);
+		if (!client)
+			return;
+
+		// what the client knows can't be told apart from what it was sent before, start over
+		if (client->view.viewRadius <= 0.0f && radius > 0.0f)
+			client->resync();
+
+		client->view.viewEntity = viewEntity;
+		client->view.viewRadius = radius;
+	}
+
+	/* Sends conn the whole world again */
+	void clearClientView(HSteamNetConnection conn) {
+		ClientSnapshotState* client = findClient(conn);
+		if (!client || client->view.viewRadius <= 0.0f)
+			return;
+
+		client->view.viewRadius = 0.0f;
+		client->resync();
+	}
+
+	/**
+	 * @brief Limits the snapshots sent to conn to bytesPerSecond, 0 for no limit. Changes that don't fit
+	 * are sent later, the most important entities first: see PrioritySettings. Removals and added
+	 * or removed components are always sent, so this is a target and not a hard limit.
+	 */
+	void setClientBandwidth(HSteamNetConnection conn, size_t bytesPerSecond) {
+		ClientSnapshotState* client = findClient(conn);
+		if (!client)
+			return;
+
+		const bool usedOwnSnapshots = client->usesOwnSnapshots();
+		client->bytesPerSecond = bytesPerSecond;
+		if (usedOwnSnapshots != client->usesOwnSnapshots())
+			client->resync();
+	}
+
+	/**
+	 * @brief Instead of one full snapshot, joining clients are sent the world bytesPerSecond at a time, or slower if the
+	 * connection can't keep up. The entities nearest to the client's view entity go first, see setClientView().
+	 * Changes to what the client already has are sent along with the stream, so it can start playing right away.
+	 * Once the client has everything it gets the same snapshots as everyone else. 0 sends the world whole.
+	 */
+	void setStreamRate(size_t bytesPerSecond) {
+		streamRate = bytesPerSecond;
+	}
+
+	/* Is the world still streamed to conn? see setStreamRate() */
+	NODISCARD bool isStreaming(HSteamNetConnection conn) const {
+		auto it = clients.find(conn);
+		return it != clients.end() && it->second.streaming;
+	}
+
+	/**
+	 * @brief How many threads besides the main thread encode snapshots, 0 encodes everything on the main thread.
+	 * The world is only read while they run, from within snapshotUpdate(). Sending stays on the main thread.
+	 */
+	void setEncodingThreads(size_t count) {
+		encodingPool.setThreadCount(count);
+
+		encoders.resize(count + 1);
+		for (auto& encoder : encoders) {
+			if (!encoder)
+				encoder = std::make_unique<NetworkStateManager::SnapshotEncoder>();
+		}
+	}
+
+	NODISCARD size_t getEncodingThreads() const { return encodingPool.getThreadCount(); }
+
+	/* One less than the hardware threads, the main thread works along, but no more than maxDefaultEncodingThreads */
+	NODISCARD static size_t getDefaultEncodingThreads() {
+		const size_t hardwareThreads = std::thread::hardware_concurrency();
+		return hardwareThreads > 1 ? std::min(hardwareThreads - 1, maxDefaultEncodingThreads) : 0;
+	}
+
+	/* tick is the client's tick of the newest input applied for conn, it is acknowledged with every snapshot. See InputChannel */
+	void setAppliedInput(HSteamNetConnection conn, u64 tick) {
+		auto it = clients.find(conn);
+		if (it == clients.end())
+			return;
+
+		it->second.hasAppliedInput = true;
+		it->second.appliedInput = tick;
 	}
 
 	/**
@@ -1736,6 +4372,61 @@ protected:
 			fullSyncUpdate(conn);
 			break;
 
+		case MESSAGE_HEADER_TIME_PING: {
+			double sendTime = 0.0;
+			des.value8b(sendTime);
+
+			// answered right away, time spent here would count as network latency
+			MessageBuffer buffer;
+			Serializer ser = startSerialize(buffer);
+			ser.object(MESSAGE_HEADER_TIME_PONG);
+			ser.value8b(sendTime);
+			ser.ext8b(getCurrentTick(), bitsery::ext::CompactValue{});
+			ser.value4b(impl::getTickProgress());
+			endSerialize(ser, buffer);
+
+			getNetworkManager().sendMessage(conn, std::move(buffer), false, false);
+		} break;
+
+		case MESSAGE_HEADER_SNAPSHOT_ACK: {
+			u32 acked = 0;
+			des.object(acked);
+
+			auto it = clients.find(conn);
+			if (it == clients.end())
+				break;
+
+			// acks are unreliable and may arrive out of order
+			if (acked > getNetworkStateManager().getSnapshotSequence()) {
+				getNetworkManager().connectionAddWarning(conn);
+				break;
+			}
+
+			ClientSnapshotState& client = it->second;
+			client.ackedSequence = std::max(client.ackedSequence, acked);
+
+			// the baseline of the next delta has the whole world, so the stream is over
+			if (client.streaming && client.view.isComplete(client.ackedSequence))
+				client.streaming = false;
+		} break;
+
+		case MESSAGE_HEADER_SCHEMA: {
+			u64 schemaHash = 0;
+			des.value8b(schemaHash);
+
+			auto it = clients.find(conn);
+			if (it == clients.end())
+				break;
+
+			if (schemaHash != getNetworkStateManager().getSchemaHash()) {
+				log(ERROR_SEVERITY_WARNING, "Client registered different networked components and was disconnected\n");
+				getNetworkManager().disconnect(conn);
+				break;
+			}
+
+			it->second.schemaMatched = true;
+		} break;
+
 		default:
 			return true;
 		}
@@ -1743,15 +4434,432 @@ protected:
 		return false;
 	}
 
+	void _internalOnConnectionJoin(HSteamNetConnection conn) override {
+		ClientSnapshotState& client = clients[conn] = ClientSnapshotState();
+		client.streaming = streamRate > 0;
+	}
+
+	void _internalOnConnectionLeave(HSteamNetConnection conn) override {
+		clients.erase(conn);
+	}
+
 	void _internalUpdate() override {
 		networkUpdate.update();
 	}
 
 protected:
+	struct ClientSnapshotState {
+		// deltas are encoded against the newest snapshot the client is known to have
+		NODISCARD u32 getBaseline() const { return std::max(ackedSequence, fullSequence); }
+
+		/* Does the client need snapshots made for it instead of the shared ones? */
+		NODISCARD bool usesOwnSnapshots() const { return view.viewRadius > 0.0f || bytesPerSecond > 0 || streaming; }
+
+		/* The next snapshot will be a full one */
+		void resync() {
+			synced = false;
+			view.reset();
+		}
+
+		bool schemaMatched = false; // snapshots are only sent once the client's schema hash arrived and matched
+		bool synced = false; // has a full snapshot been sent
+		bool streaming = false; // the full snapshot is empty and the world follows in deltas, see setStreamRate()
+		u32 fullSequence = 0;
+		u32 ackedSequence = 0;
+
+		NetworkStateManager::ClientView view; // see setClientView()
+		size_t bytesPerSecond = 0; // see setClientBandwidth()
+
+		bool hasAppliedInput = false;
+		u64 appliedInput = 0; // see setAppliedInput()
+	};
+
+	void sendInputAck(HSteamNetConnection conn, u32 sequence, u64 inputTick) {
+		MessageBuffer buffer;
+		Serializer ser = startSerialize(buffer);
+		ser.object(MESSAGE_HEADER_INPUT_ACK);
+		ser.ext4b(sequence, bitsery::ext::CompactValue{});
+		ser.ext8b(inputTick, bitsery::ext::CompactValue{});
+		endSerialize(ser, buffer);
+
+		getNetworkManager().sendMessage(conn, std::move(buffer), false, false);
+	}
+
+	ClientSnapshotState* findClient(HSteamNetConnection conn) {
+		auto it = clients.find(conn);
+		if (it == clients.end()) {
+			log(ERROR_SEVERITY_WARNING, "Invalid client connection: %u\n", conn);
+			return nullptr;
+		}
+
+		return &it->second;
+	}
+
+	// deltas for the client can start from the full snapshot, they are dropped until it arrives
+	void markFullSynced(ClientSnapshotState& client) {
+		client.synced = true;
+		client.fullSequence = getNetworkStateManager().getSnapshotSequence();
+	}
+
+	void sendFullSnapshot(const std::vector<HSteamNetConnection>& targets) {
+		if (targets.empty())
+			return;
+
+		NetworkStateManager& stateManager = getNetworkStateManager();
+
+		// the world only changes during ticks, so a full snapshot of the same tick and sequence is still exact
+		if (!sharedFullSnapshot.valid || sharedFullSnapshot.tick != getCurrentTick() || sharedFullSnapshot.sequence != stateManager.getSnapshotSequence()) {
+			MessageBuffer fullsnapshot(fullSizeHint);
+			stateManager.createFullSnapshot(fullsnapshot);
+			fullSizeHint = fullsnapshot.getSize();
+
+			sharedFullSnapshot.buffer = std::move(fullsnapshot);
+			sharedFullSnapshot.tick = getCurrentTick();
+			sharedFullSnapshot.sequence = stateManager.getSnapshotSequence();
+			sharedFullSnapshot.valid = true;
+		}
+
+		getNetworkManager().sendMessage(targets, sharedFullSnapshot.buffer.share(), true);
+	}
+
+	/* Sends conn a full snapshot made for it right away, a delta is queued as a ClientJob for encodeDeltaSnapshots() */
+	void clientSnapshotUpdate(HSteamNetConnection conn, ClientSnapshotState& client, u32 sequence) {
+		NetworkStateManager& stateManager = getNetworkStateManager();
+
+		u32 baseline = client.getBaseline();
+		if (client.synced && baseline == sequence)
+			return;
+
+		size_t bytesPerSecond = client.bytesPerSecond;
+		if (client.streaming) {
+			size_t rate = streamRate;
+			size_t sendRate = getNetworkManager().getSendRate(conn);
+			if (sendRate > 0)
+				rate = std::min(rate, sendRate);
+
+			bytesPerSecond = bytesPerSecond > 0 ? std::min(bytesPerSecond, rate) : rate;
+		}
+
+		client.view.byteBudget = bytesPerSecond > 0 ? std::max<size_t>(1, (size_t)(bytesPerSecond / networkUpdate.getRate())) : 0;
+
+		// full snapshots run the snapshot systems, so they can't be encoded in parallel with anything
+		if (!client.synced || !stateManager.canCreateClientSnapshot(client.view, baseline)) {
+			MessageBuffer snapshot(client.streaming ? deltaSizeHint : fullSizeHint);
+
+			// a stream that can't be continued starts over
+			if (client.streaming)
+				stateManager.createClientEmptySnapshot(snapshot, client.view);
+			else
+				stateManager.createClientFullSnapshot(snapshot, client.view);
+
+			client.synced = true;
+			client.fullSequence = sequence;
+
+			getNetworkManager().sendMessage(conn, std::move(snapshot), false, true);
+			return;
+		}
+
+		if (clientJobCount == clientJobs.size())
+			clientJobs.emplace_back();
+
+		ClientJob& job = clientJobs[clientJobCount++];
+		job.conn = conn;
+		job.client = &client;
+		job.baseline = baseline;
+
+		// finding what the client sees queries the world, which only the main thread may do
+		job.seesWorld = client.view.viewRadius <= 0.0f;
+		if (!job.seesWorld)
+			stateManager.findViewEntities(client.view, job.viewEntities);
+		else if (!foundWorldEntities) {
+			stateManager.findNetworkedEntities(worldEntities);
+			foundWorldEntities = true;
+		}
+	}
+
+	/* Encodes the snapshots of the baseline groups and the client jobs on the encoding threads */
+	void encodeDeltaSnapshots() {
+		NetworkStateManager& stateManager = getNetworkStateManager();
+
+		// clients sharing a baseline end up next to each other, so a worker can often reuse its merge of the frames
+		std::sort(clientJobs.begin(), clientJobs.begin() + clientJobCount, [](const ClientJob& a, const ClientJob& b) {
+			return a.baseline < b.baseline;
+		});
+
+		for (size_t i = 0; i < baselineGroupCount; i++)
+			baselineGroups[i].snapshot = MessageBuffer(deltaSizeHint);
+		for (size_t i = 0; i < clientJobCount; i++)
+			clientJobs[i].snapshot = MessageBuffer(deltaSizeHint);
+
+		encodingPool.parallelFor(baselineGroupCount + clientJobCount, [&](size_t i, size_t worker) {
+			NetworkStateManager::SnapshotEncoder& encoder = *encoders[worker];
+
+			if (i < baselineGroupCount) {
+				BaselineGroup& group = baselineGroups[i];
+				stateManager.createDeltaSnapshot(group.snapshot, group.baseline, encoder);
+				return;
+			}
+
+			ClientJob& job = clientJobs[i - baselineGroupCount];
+			const NetworkStateManager::EntityIdList& relevant = job.seesWorld ? worldEntities : job.viewEntities;
+			stateManager.createClientSnapshot(job.snapshot, job.baseline, job.client->view, relevant, encoder);
+		});
+	}
+
 	HSteamListenSocket listen = k_HSteamListenSocket_Invalid;
+	std::unordered_map<HSteamNetConnection, ClientSnapshotState> clients;
+	struct BaselineGroup {
+		u32 baseline = 0;
+		std::vector<HSteamNetConnection> targets;
+		MessageBuffer snapshot;
+	};
+
+	/* A client sent its own delta this update, see clientSnapshotUpdate() */
+	struct ClientJob {
+		HSteamNetConnection conn = k_HSteamNetConnection_Invalid;
+		ClientSnapshotState* client = nullptr;
+		u32 baseline = 0;
+		bool seesWorld = false; // relevant are the worldEntities instead of the viewEntities
+		NetworkStateManager::EntityIdList viewEntities;
+		MessageBuffer snapshot;
+	};
+
+	/* The group of clients sharing baseline this update, groups are recycled so their lists keep their capacity */
+	BaselineGroup& getBaselineGroup(u32 baseline) {
+		for (size_t i = 0; i < baselineGroupCount; i++)
+			if (baselineGroups[i].baseline == baseline)
+				return baselineGroups[i];
+
+		if (baselineGroupCount == baselineGroups.size())
+			baselineGroups.emplace_back();
+
+		BaselineGroup& group = baselineGroups[baselineGroupCount++];
+		group.baseline = baseline;
+		group.targets.clear();
+		return group;
+	}
+
+	std::vector<BaselineGroup> baselineGroups; // the first baselineGroupCount are in use
+	size_t baselineGroupCount = 0;
+	std::vector<HSteamNetConnection> fullSyncTargets;
+
+	std::vector<ClientJob> clientJobs; // the first clientJobCount are in use
+	size_t clientJobCount = 0;
+	NetworkStateManager::EntityIdList worldEntities; // found once per update for every client that sees the whole world
+	bool foundWorldEntities = false;
+
+	static constexpr size_t maxDefaultEncodingThreads = 3;
+	impl::WorkerPool encodingPool;
+	std::vector<std::unique_ptr<NetworkStateManager::SnapshotEncoder>> encoders; // one per worker, see WorkerPool::parallelFor()
+
+	static constexpr size_t defaultStreamRate = 256 * 1024;
+	size_t streamRate = defaultStreamRate; // see setStreamRate()
+
+	// snapshots are about as big as the last one, so their buffers start out that big
+	size_t deltaSizeHint = MessageBuffer::defaultCapacity;
+	size_t fullSizeHint = MessageBuffer::defaultCapacity;
+
+	// the last full snapshot encoded, see sendFullSnapshot()
+	struct SharedFullSnapshot {
+		bool valid = false;
+		u64 tick = 0;
+		u32 sequence = 0;
+		MessageBuffer buffer;
+	} sharedFullSnapshot;
 
 private:
 	Ticker<void(float)> networkUpdate;
 };
 
+/**
+ * @brief A stream of tick stamped player input from clients to the server. Input is any
+ * bitsery serializable type.
+ * 
+ * Clients call send() once per tick. Every message repeats the last few inputs, so it is sent
+ * unreliably and a lost message is covered by the next one.
+ * 
+ * The server buffers the inputs of every connection and calls forEachInput() once per tick to
+ * apply them. Each client's ticks are mapped to server ticks "inputDelay" ticks in the future when
+ * its first input arrives, so inputs are applied at the same pace they were made in, no matter
+ * when the network delivers them. If inputs keep arriving too late the mapping is moved back.
+ * The newest applied input is acknowledged with every snapshot for Prediction.
+ */
+template<typename Input>
+class InputChannel {
+public:
+	static constexpr u8 defaultRedundancy = 4; // how many messages every input is sent in
+	static constexpr u32 defaultInputDelay = 2; // ticks inputs wait on the server to absorb jitter
+	static constexpr size_t bufferLength = 64; // inputs further ahead than this are dropped
+
+	InputChannel() {
+		getNetworkManager().setMessageHandler(MESSAGE_HEADER_INPUT, [this](HSteamNetConnection conn, Deserializer& des) {
+			receive(conn, des);
+		});
+	}
+
+	~InputChannel() {
+		getNetworkManager().setMessageHandler(MESSAGE_HEADER_INPUT, nullptr);
+	}
+
+	InputChannel(const InputChannel&) = delete;
+	InputChannel& operator=(const InputChannel&) = delete;
+
+	void setRedundancy(u8 count) {
+		assert(count > 0);
+		redundancy = count;
+	}
+
+	void setInputDelay(u32 ticks) { inputDelay = ticks; }
+
+	/* Client side, sends input as the input of the current tick */
+	void send(HSteamNetConnection server, const Input& input) {
+		const u64 tick = getCurrentTick();
+
+		sent[tick % sent.size()] = { tick, true, input };
+
+		MessageBuffer buffer;
+		Serializer ser = startSerialize(buffer);
+		ser.object(MESSAGE_HEADER_INPUT);
+		ser.ext8b(tick, bitsery::ext::CompactValue{});
+
+		u8 count = 0;
+		for (u64 age = 0; age < redundancy && age <= tick; age++)
+			count += sent[(tick - age) % sent.size()].isFor(tick - age);
+		ser.value1b(count);
+
+		// newest first, each tick as its distance to the previous one
+		u64 previous = tick;
+		for (u64 age = 0; age < redundancy && age <= tick; age++) {
+			SentInput& stored = sent[(tick - age) % sent.size()];
+			if (!stored.isFor(tick - age))
+				continue;
+
+			u32 distance = (u32)(previous - stored.tick);
+			ser.ext4b(distance, bitsery::ext::CompactValue{});
+			ser.object(stored.input);
+			previous = stored.tick;
+		}
+		endSerialize(ser, buffer);
+
+		getNetworkManager().sendMessage(server, std::move(buffer), false, false);
+	}
+
+	/* Server side, calls callback(HSteamNetConnection conn, const Input& input) for the input of every client due this tick */
+	template<typename F>
+	void forEachInput(F&& callback) {
+		NetworkManager& networkManager = getNetworkManager();
+		const i64 serverTick = (i64)getCurrentTick();
+
+		for (auto it = clients.begin(); it != clients.end();) {
+			if (!networkManager.hasConnection(it->first)) {
+				it = clients.erase(it);
+				continue;
+			}
+
+			ClientInputs& client = it->second;
+			const i64 clientTick = serverTick - client.tickOffset;
+			if (!client.mapped || clientTick <= (i64)client.lastApplied) {
+				++it;
+				continue;
+			}
+
+			const StoredInput& stored = client.inputs[(u64)clientTick % client.inputs.size()];
+			if (stored.valid && stored.tick == (u64)clientTick) {
+				client.lastInput = stored.input;
+				client.hasLastInput = true;
+			}
+
+			// a lost input repeats the one before it, the client predicted with the real one and gets corrected
+			if (client.hasLastInput) {
+				callback(it->first, (const Input&)client.lastInput);
+
+				client.lastApplied = (u64)clientTick;
+				if (networkManager.hasNetworkInterface<ServerInterface>())
+					networkManager.getNetworkInterface<ServerInterface>().setAppliedInput(it->first, client.lastApplied);
+			}
+
+			++it;
+		}
+	}
+
+private:
+	void receive(HSteamNetConnection conn, Deserializer& des) {
+		u64 tick = 0;
+		u8 count = 0;
+		des.ext8b(tick, bitsery::ext::CompactValue{});
+		des.value1b(count);
+
+		ClientInputs& client = clients[conn];
+		const i64 serverTick = (i64)getCurrentTick();
+
+		// a few late messages are jitter, if they keep coming late the client fell behind and is mapped again
+		const bool late = (i64)tick + client.tickOffset < serverTick;
+		client.lateMessages = late ? client.lateMessages + 1 : 0;
+		if (!client.mapped || client.lateMessages > inputDelay) {
+			client.tickOffset = serverTick + (i64)inputDelay - (i64)tick;
+			client.mapped = true;
+			client.lateMessages = 0;
+		}
+
+		u64 current = tick;
+		for (u8 i = 0; i < count; i++) {
+			u32 distance = 0;
+			des.ext4b(distance, bitsery::ext::CompactValue{});
+			if (distance > current) {
+				des.adapter().error(bitsery::ReaderError::InvalidData);
+				return;
+			}
+
+			current -= distance;
+
+			Input input;
+			des.object(input);
+
+			if (current <= client.lastApplied)
+				continue; // already applied, or given up on
+			if ((i64)current + client.tickOffset >= serverTick + (i64)bufferLength)
+				continue; // too far ahead to buffer
+
+			StoredInput& stored = client.inputs[current % client.inputs.size()];
+			stored.tick = current;
+			stored.valid = true;
+			stored.input = input;
+		}
+	}
+
+	struct SentInput {
+		u64 tick = 0;
+		bool valid = false;
+		Input input;
+
+		NODISCARD bool isFor(u64 forTick) const { return valid && tick == forTick; }
+	};
+
+	struct StoredInput {
+		u64 tick = 0;
+		bool valid = false;
+		Input input;
+	};
+
+	struct ClientInputs {
+		ClientInputs()
+			: inputs(bufferLength) {}
+
+		bool mapped = false;
+		i64 tickOffset = 0; // server tick - client tick
+		u32 lateMessages = 0; // in a row
+		u64 lastApplied = 0; // client tick
+
+		std::vector<StoredInput> inputs; // indexed by client tick
+		Input lastInput;
+		bool hasLastInput = false;
+	};
+
+	u8 redundancy = defaultRedundancy;
+	u32 inputDelay = defaultInputDelay;
+
+	std::array<SentInput, 32> sent; // client side, indexed by tick
+	std::unordered_map<HSteamNetConnection, ClientInputs> clients; // server side
+};
+
 AE_NAMESPACE_END
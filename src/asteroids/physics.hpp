@@ -1,5 +1,17 @@
 #pragma once
 #include "includes.hpp"
+#include "logging.hpp"
+
+// Set AE_PHYSICS_STATS to 0 to compile the physics counters and phase timers out
+#ifndef AE_PHYSICS_STATS
+#define AE_PHYSICS_STATS 1
+#endif
+
+#if AE_PHYSICS_STATS
+#define AE_PHYSICS_STAT(expr) expr
+#else
+#define AE_PHYSICS_STAT(expr)
+#endif
 
 AE_NAMESPACE_BEGIN
 
@@ -34,6 +46,29 @@ inline sf::Vector2f fastRotateWithPrecalc(sf::Vector2f v, float sin, float cos)
 	return result;
 }
 
+namespace impl {
+	template<typename F, size_t ... I>
+	inline void unrollImpl(F&& f, std::index_sequence<I...>) {
+		(f(std::integral_constant<size_t, I>{}), ...);
+	}
+
+	template<typename F, size_t ... I>
+	inline bool unrollWhileImpl(F&& f, std::index_sequence<I...>) {
+		return (f(std::integral_constant<size_t, I>{}) && ...);
+	}
+
+	// Calls f(std::integral_constant<size_t, I>) for every I in [0, N), without a runtime loop
+	template<size_t N, typename F>
+	inline void unroll(F&& f) {
+		unrollImpl(f, std::make_index_sequence<N>{});
+	}
+
+	// Same as unroll(), but stops as soon as f returns false. Returns false if any call did.
+	template<size_t N, typename F>
+	inline bool unrollWhile(F&& f) {
+		return unrollWhileImpl(f, std::make_index_sequence<N>{});
+	}
+}
 
 struct AABB {
 	AABB() {
@@ -56,6 +91,15 @@ struct AABB {
 	bool isPointInside(sf::Vector2f v) {
 		return min[0] <= v.x && v.x <= max[0] && min[1] <= v.y && v.y <= max[1];
 	}
+
+	NODISCARD AABB translated(sf::Vector2f offset) const {
+		AABB aabb = *this;
+		aabb.min[0] += offset.x;
+		aabb.min[1] += offset.y;
+		aabb.max[0] += offset.x;
+		aabb.max[1] += offset.y;
+		return aabb;
+	}
 };
 
 // doess aabb1 collide with aabb2
@@ -78,6 +122,9 @@ inline bool testCollision(const AABB& aabb1, const AABB& aabb2) {
 enum class ShapeEnum : u8 {
 	Polygon = 0,
 	Circle,
+	Polygon3, // PolygonN<3>
+	Polygon4, // PolygonN<4>
+	Polygon8, // PolygonN<8>
 	Invalid
 };
 
@@ -122,11 +169,17 @@ public:
 	NODISCARD u16 getCollisionMask() const { return collisionMask; }
 	void setCollisonMask(u16 newMask) { collisionMask = newMask; }
 
+	// Sensors only report when other shapes start or stop overlapping them (see PhysicsWorld::getSensorEnters()).
+	// They never generate a manifold or a CollisionEvent, and two sensors never test against eachother.
+	NODISCARD bool isSensor() const { return sensor; }
+	void setSensor(bool isSensor) { sensor = isSensor; markFullDirty(); }
+
 	template<typename S>
 	void serialize(S& s) {
 		s.value4b(rot);
 		s.object(pos);
 		s.value2b(collisionMask);
+		s.boolValue(sensor);
 	}
 protected:
 	virtual void Update() {}
@@ -145,6 +198,7 @@ protected:
 	float rot;
 	sf::Vector2f pos;
 	u16 collisionMask;
+	bool sensor = false;
 };
 
 class Circle : public Shape {
@@ -177,6 +231,50 @@ private:
 	float radius;
 };
 
+namespace impl {
+	// Sorts vertices into CCW order and computes the centroid, radius and the normals
+	// of a convex polygon. Shared by Polygon and PolygonN.
+	inline void fixPolygonVertices(sf::Vector2f* vertices, sf::Vector2f* normals, u8 count, sf::Vector2f& centroid, float& radius) {
+		centroid = { 0.0f, 0.0f };
+		std::for_each(vertices, vertices + count, [&](const sf::Vector2f& vertex) {
+			centroid += vertex;
+			});
+		centroid /= (float)count;
+
+		radius = 0.0f;
+		std::for_each(vertices, vertices + count, [&](const sf::Vector2f& vertex) {
+			float distance = (centroid - vertex).length();
+
+			if (distance > radius) {
+				radius = distance;
+			}
+			});
+
+		sf::Vector2f midpoint2 = { centroid.x, centroid.y + 1.0f };
+		sf::Vector2f midsegment = (centroid - midpoint2).normalized();
+
+		// sort vertices to be CCW order
+		std::sort(vertices, vertices + count,
+			[&](sf::Vector2f v1, sf::Vector2f v2) {
+				sf::Angle a1 = midsegment.angleTo(v1 - centroid);
+				sf::Angle a2 = midsegment.angleTo(v2 - centroid);
+
+				return a1 < a2;
+			});
+
+		// normals
+		for (u8 i = 0; i < count; i++) {
+			sf::Vector2f va = vertices[i];
+			sf::Vector2f vb = vertices[(i + 1) % count];
+
+			sf::Vector2f edge = vb - va;
+			edge = edge.normalized();
+
+			normals[i] = sf::Vector2f(edge.y, -edge.x);
+		}
+	}
+}
+
 // Convex polygons only.
 class Polygon : public Shape {
 public:
@@ -212,8 +310,8 @@ public:
 
 		aabb.min[0] = std::numeric_limits<float>::max();
 		aabb.min[1] = std::numeric_limits<float>::max();
-		aabb.max[0] = std::numeric_limits<float>::min();
-		aabb.max[1] = std::numeric_limits<float>::min();
+		aabb.max[0] = std::numeric_limits<float>::lowest();
+		aabb.max[1] = std::numeric_limits<float>::lowest();
 
 		if (localFlags[LOCAL_DIRTY])
 			computeWorldVertices();
@@ -284,43 +382,7 @@ protected:
 	bool fixVertices() {
 		assert(3 <= verticesCount && verticesCount <= 8);
 
-		centroid = { 0.0f, 0.0f };
-		std::for_each(vertices.begin(), vertices.begin() + verticesCount, [&](const sf::Vector2f& vertex) {
-			centroid += vertex;
-			});
-		centroid /= (float)verticesCount;
-
-		radius = 0.0f;
-		std::for_each(vertices.begin(), vertices.begin() + verticesCount, [&](const sf::Vector2f& vertex) {
-			float distance = (centroid - vertex).length();
-
-			if (distance > radius) {
-				distance = radius;
-			}
-			});
-
-		sf::Vector2f midpoint2 = { centroid.x, centroid.y + 1.0f };
-		sf::Vector2f midsegment = (centroid - midpoint2).normalized();
-
-		// sort vertices to be CCW order
-		std::sort(vertices.begin(), vertices.begin() + verticesCount,
-			[&](sf::Vector2f v1, sf::Vector2f v2) {
-				sf::Angle a1 = midsegment.angleTo(v1 - centroid);
-				sf::Angle a2 = midsegment.angleTo(v2 - centroid);
-
-				return a1 < a2;
-			});
-
-		// normals
-		for (u8 i = 0; i < verticesCount; i++) {
-			sf::Vector2f va = vertices[i];
-			sf::Vector2f vb = vertices[(i + 1) % verticesCount];
-
-			sf::Vector2f edge = vb - va;
-			edge = edge.normalized();
-
-			normals[i] = sf::Vector2f(edge.y, -edge.x);
-		}
+		impl::fixPolygonVertices(vertices.data(), normals.data(), verticesCount, centroid, radius);
 
 		return true;
 	}
@@ -350,6 +412,165 @@ private:
 };
 
 
+template<u8 N>
+struct PolygonNShapeEnum;
+
+template<> struct PolygonNShapeEnum<3> { static constexpr ShapeEnum value = ShapeEnum::Polygon3; };
+template<> struct PolygonNShapeEnum<4> { static constexpr ShapeEnum value = ShapeEnum::Polygon4; };
+template<> struct PolygonNShapeEnum<8> { static constexpr ShapeEnum value = ShapeEnum::Polygon8; };
+
+/*
+ * A convex polygon whose vertex count is fixed at compile time.
+ *
+ * Unlike Polygon, which always reserves room for 8 vertices, PolygonN<N> only stores N,
+ * and its transform and SAT loops are fully unrolled. Only the counts that have a
+ * PolygonNShapeEnum specialization can be stored in the PhysicsWorld.
+ */
+template<u8 N>
+class PolygonN : public Shape {
+	static_assert(3 <= N && N <= 8, "PolygonN supports 3 to 8 vertices");
+public:
+	typedef std::array<sf::Vector2f, N> vertices_t;
+	static constexpr u8 verticesCount = N;
+
+	PolygonN()
+		: Shape(), vertices(), normals(), radius(0.0f) {}
+
+	PolygonN(const std::initializer_list<sf::Vector2f>& localVertices)
+		: Shape() {
+		assert(localVertices.size() == N);
+		memcpy(vertices.data(), localVertices.begin(), N * sizeof(sf::Vector2f));
+		fixVertices(); // radius initialized here
+	}
+
+	PolygonN(sf::Vector2f pos, float rot)
+		: Shape(pos, rot), vertices(), normals(), radius(0.0f) {
+	}
+
+	PolygonN(sf::Vector2f pos, float rot, const std::initializer_list<sf::Vector2f>& localVertices)
+		: Shape(pos, rot) {
+		assert(localVertices.size() == N);
+		memcpy(vertices.data(), localVertices.begin(), N * sizeof(sf::Vector2f));
+		fixVertices(); // radius initialized here
+	}
+
+	NODISCARD virtual sf::Vector2f getCentroid() const override { return centroid; }
+
+	NODISCARD virtual ShapeEnum getType() const override { return PolygonNShapeEnum<N>::value; }
+
+	NODISCARD float getRadius() const override { return radius; }
+
+	NODISCARD AABB getAABB() override {
+		if (localFlags[LOCAL_DIRTY])
+			computeWorldVertices();
+
+		AABB aabb;
+		aabb.min[0] = aabb.max[0] = cache.vertices[0].x;
+		aabb.min[1] = aabb.max[1] = cache.vertices[0].y;
+
+		impl::unroll<N - 1>([&](auto i) {
+			const sf::Vector2f& vertex = cache.vertices[i + 1];
+
+			aabb.min[0] = std::min(aabb.min[0], vertex.x);
+			aabb.max[0] = std::max(aabb.max[0], vertex.x);
+			aabb.min[1] = std::min(aabb.min[1], vertex.y);
+			aabb.max[1] = std::max(aabb.max[1], vertex.y);
+		});
+
+		return aabb;
+	}
+
+	void setVertices(const sf::Vector2f* localVertices) {
+		memcpy(vertices.data(), localVertices, N * sizeof(sf::Vector2f));
+		fixVertices();
+		computeWorldVertices();
+	}
+
+	NODISCARD u8 getVerticeCount() const {
+		return N;
+	}
+
+	NODISCARD const vertices_t& getWorldVertices() {
+		if (localFlags[LOCAL_DIRTY])
+			computeWorldVertices();
+
+		return cache.vertices;
+	}
+
+	NODISCARD const vertices_t& getWorldNormals() {
+		if (localFlags[LOCAL_DIRTY])
+			computeWorldVertices();
+
+		return cache.normals;
+	}
+
+	// The vertex count is implied by the shape type, so only the vertices go over the wire
+	template<typename S>
+	void serialize(S& s) {
+		s.ext(*this, bitsery::ext::BaseClass<Shape>{});
+
+		for (u8 i = 0; i < N; i++) {
+			s.object(vertices[i]);
+		}
+	}
+
+protected:
+	void fixVertices() {
+		impl::fixPolygonVertices(vertices.data(), normals.data(), N, centroid, radius);
+	}
+
+	void computeWorldVertices() {
+		localFlags[LOCAL_DIRTY] = false;
+
+		const float sin = fastSin(rot);
+		const float cos = fastCos(rot);
+
+		impl::unroll<N>([&](auto i) {
+			cache.vertices[i] = fastRotateWithPrecalc(vertices[i], sin, cos) + pos;
+			cache.normals[i] = fastRotateWithPrecalc(normals[i], sin, cos);
+		});
+	}
+
+	struct {
+		vertices_t vertices;
+		vertices_t normals;
+	} cache;
+private:
+	sf::Vector2f centroid;
+	vertices_t vertices;
+	vertices_t normals;
+
+	float radius;
+};
+
+typedef PolygonN<3> Triangle;
+typedef PolygonN<4> Quad;
+typedef PolygonN<8> Octagon;
+
+/* Calls f with shape cast to its concrete type, e.g. Circle& or PolygonN<3>& */
+template<typename F>
+inline decltype(auto) visitShape(Shape& shape, F&& f) {
+	switch (shape.getType()) {
+	case ShapeEnum::Polygon:  return f(static_cast<Polygon&>(shape));
+	case ShapeEnum::Circle:   return f(static_cast<Circle&>(shape));
+	case ShapeEnum::Polygon3: return f(static_cast<PolygonN<3>&>(shape));
+	case ShapeEnum::Polygon4: return f(static_cast<PolygonN<4>&>(shape));
+	case ShapeEnum::Polygon8: return f(static_cast<PolygonN<8>&>(shape));
+	default:
+		break;
+	}
+
+	log(ERROR_SEVERITY_FATAL, "Invalid Shape Type\n");
+	return std::invoke_result_t<F, Circle&>(); // silences warnings
+}
+
+template<typename T>
+struct IsPolygon : std::false_type {};
+template<>
+struct IsPolygon<Polygon> : std::true_type {};
+template<u8 N>
+struct IsPolygon<PolygonN<N>> : std::true_type {};
+
 struct CollisionManifold {
 	CollisionManifold() {
 		depth = std::numeric_limits<float>::max();
@@ -386,6 +607,22 @@ inline Projection project(const Polygon::vertices_t& vertices, sf::Vector2f norm
 	return projection;
 }
 
+template<size_t N>
+inline Projection project(const std::array<sf::Vector2f, N>& vertices, sf::Vector2f normal) {
+	Projection projection;
+	projection.min = normal.dot(vertices[0]);
+	projection.max = projection.min;
+
+	impl::unroll<N - 1>([&](auto i) {
+		float projected = normal.dot(vertices[i + 1]);
+
+		projection.min = std::min(projection.min, projected);
+		projection.max = std::max(projection.max, projected);
+	});
+
+	return projection;
+}
+
 inline float pointSegmentDistance(sf::Vector2f p, sf::Vector2f v1, sf::Vector2f v2, sf::Vector2f& cp) {
 	// credit goes to https://www.youtube.com/watch?v=egmZJU-1zPU&ab_channel=Two-BitCoding
 	// for this function, incredible channel and resource
@@ -419,16 +656,22 @@ inline float pointSegmentDistance(sf::Vector2f p, sf::Vector2f v1, sf::Vector2f
  * @param normals1 A set of normals that were calculated from vertices 1
  * @param depth An out parameter of the depth of the penetration
  * @param normal An out parameter of the normal of the minimum translation vector
+ * @param offset2 A translation applied to vertices2, used for wrap-around worlds
  * @return True if a collision was found, false otherwise
  */
+template<typename Vertices1, typename Vertices2>
 inline bool satHalfTest(
-	const Polygon::vertices_t& vertices1,
-	const Polygon::vertices_t& vertices2,
+	const Vertices1& vertices1,
+	const Vertices2& vertices2,
 	const Polygon::vertices_t& normals1,
-	float& depth, sf::Vector2f& normal) {
+	float& depth, sf::Vector2f& normal,
+	sf::Vector2f offset2 = {}) {
 	for (u32 i = 0; i < normals1.size(); i++) {
 		Projection proj1 = project(vertices1, normals1[i]);
 		Projection proj2 = project(vertices2, normals1[i]);
+		const float shift = normals1[i].dot(offset2);
+		proj2.min += shift;
+		proj2.max += shift;
 
 		if (!(proj1.max >= proj2.min && proj2.max >= proj1.min)) {
 			// they are not collding
@@ -447,6 +690,37 @@ inline bool satHalfTest(
 	return true;
 }
 
+// Same as above, but the normals' count is known at compile time so the loop is unrolled
+template<typename Vertices1, typename Vertices2, size_t N>
+inline bool satHalfTest(
+	const Vertices1& vertices1,
+	const Vertices2& vertices2,
+	const std::array<sf::Vector2f, N>& normals1,
+	float& depth, sf::Vector2f& normal,
+	sf::Vector2f offset2 = {}) {
+	return impl::unrollWhile<N>([&](auto i) {
+		Projection proj1 = project(vertices1, normals1[i]);
+		Projection proj2 = project(vertices2, normals1[i]);
+		const float shift = normals1[i].dot(offset2);
+		proj2.min += shift;
+		proj2.max += shift;
+
+		if (!(proj1.max >= proj2.min && proj2.max >= proj1.min)) {
+			// they are not collding
+			return false;
+		}
+
+		float new_depth = std::max(0.0f, std::min(proj1.max, proj2.max) - std::max(proj1.min, proj2.min));
+
+		if (new_depth <= depth) {
+			normal = normals1[i];
+			depth = new_depth;
+		}
+
+		return true;
+	});
+}
+
 /**
  * @brief Takes in 2 polygons whose vertices and normals will be compared
  * to eachother to determine if a collision has occurred. Resulting information
@@ -456,26 +730,31 @@ inline bool satHalfTest(
  * @param shape2 a shape that will be compared to shape1 for a collision
  * @param manifold an output parameter. The members normal and depth will be changed, whether
  * or not a collision was found.
+ * @param offset2 a translation applied to shape2. In wrap-around worlds this is the
+ * minimum-image offset, see PhysicsWorld::getMinimumImageOffset()
  * @return true if a collision was to be found, false otherwise
  */
-inline bool testCollision(Polygon& poly1, Polygon& poly2, CollisionManifold& manifold) {
-	auto vertices1 = poly1.getWorldVertices();
-	auto normals1 = poly1.getWorldNormals();
-	auto vertices2 = poly2.getWorldVertices();
-	auto normals2 = poly2.getWorldNormals();
-
-	if (!satHalfTest(vertices1, vertices2, normals1, manifold.depth, manifold.normal))
+template<typename Polygon1, typename Polygon2,
+	std::enable_if_t<IsPolygon<Polygon1>::value && IsPolygon<Polygon2>::value, int> = 0>
+inline bool testCollision(Polygon1& poly1, Polygon2& poly2, CollisionManifold& manifold, sf::Vector2f offset2 = {}) {
+	const auto& vertices1 = poly1.getWorldVertices();
+	const auto& normals1 = poly1.getWorldNormals();
+	const auto& vertices2 = poly2.getWorldVertices();
+	const auto& normals2 = poly2.getWorldNormals();
+
+	if (!satHalfTest(vertices1, vertices2, normals1, manifold.depth, manifold.normal, offset2))
 		return false;
 
-	if (!satHalfTest(vertices2, vertices1, normals2, manifold.depth, manifold.normal))
+	// moving poly2 by offset2 is the same as moving poly1 by -offset2
+	if (!satHalfTest(vertices2, vertices1, normals2, manifold.depth, manifold.normal, -offset2))
 		return false;
 
 	return true;
 }
 
-inline bool testCollision(Circle& circle1, Circle& circle2, CollisionManifold& manifold) {
+inline bool testCollision(Circle& circle1, Circle& circle2, CollisionManifold& manifold, sf::Vector2f offset2 = {}) {
 	float total_radius = circle1.getRadius() + circle2.getRadius();
-	sf::Vector2f  dir = circle2.getPos() - circle1.getPos();
+	sf::Vector2f  dir = circle2.getPos() + offset2 - circle1.getPos();
 	float length = dir.length();
 
 	if (total_radius > length) {
@@ -490,16 +769,18 @@ inline bool testCollision(Circle& circle1, Circle& circle2, CollisionManifold& m
 	return false;
 }
 
-inline bool testCollision(Polygon& Polygon, Circle& Circle, CollisionManifold& manifold) {
-	auto vertices = Polygon.getWorldVertices();
-	auto normals = Polygon.getWorldNormals();
+template<typename PolygonType, std::enable_if_t<IsPolygon<PolygonType>::value, int> = 0>
+inline bool testCollision(PolygonType& Polygon, Circle& Circle, CollisionManifold& manifold, sf::Vector2f offset2 = {}) {
+	const auto& vertices = Polygon.getWorldVertices();
+	const auto& normals = Polygon.getWorldNormals();
+	const sf::Vector2f circlePos = Circle.getPos() + offset2;
 
 	for (u32 i = 0; i < vertices.size(); i++) {
 		const sf::Vector2f& v1 = vertices[i];
 		const sf::Vector2f& v2 = vertices[(i + 1) % vertices.size()];
 		sf::Vector2f cp = {};
 
-		float dist = pointSegmentDistance(Circle.getPos(), v1, v2, cp);
+		float dist = pointSegmentDistance(circlePos, v1, v2, cp);
 		if (dist < manifold.depth) {
 			manifold.depth = dist;
 			manifold.normal = normals[i];
@@ -514,6 +795,70 @@ inline bool testCollision(Polygon& Polygon, Circle& Circle, CollisionManifold& m
 	return false;
 }
 
+namespace impl {
+	template<typename Vertices1, typename Vertices2, typename Normals1>
+	inline bool satHalfOverlap(const Vertices1& vertices1, const Vertices2& vertices2, const Normals1& normals1, sf::Vector2f offset2) {
+		for (u32 i = 0; i < normals1.size(); i++) {
+			Projection proj1 = project(vertices1, normals1[i]);
+			Projection proj2 = project(vertices2, normals1[i]);
+			const float shift = normals1[i].dot(offset2);
+
+			if (!(proj1.max >= proj2.min + shift && proj2.max + shift >= proj1.min))
+				return false;
+		}
+
+		return true;
+	}
+}
+
+/*
+ * testOverlap() is the cheap version of testCollision() used by sensors.
+ * It only answers whether the two shapes overlap, no depth or normal is computed.
+ */
+template<typename Polygon1, typename Polygon2,
+	std::enable_if_t<IsPolygon<Polygon1>::value && IsPolygon<Polygon2>::value, int> = 0>
+inline bool testOverlap(Polygon1& poly1, Polygon2& poly2, sf::Vector2f offset2 = {}) {
+	const auto& vertices1 = poly1.getWorldVertices();
+	const auto& vertices2 = poly2.getWorldVertices();
+
+	return impl::satHalfOverlap(vertices1, vertices2, poly1.getWorldNormals(), offset2) &&
+		   impl::satHalfOverlap(vertices2, vertices1, poly2.getWorldNormals(), -offset2);
+}
+
+inline bool testOverlap(Circle& circle1, Circle& circle2, sf::Vector2f offset2 = {}) {
+	const float totalRadius = circle1.getRadius() + circle2.getRadius();
+	const sf::Vector2f dir = circle2.getPos() + offset2 - circle1.getPos();
+
+	return dir.lengthSq() < totalRadius * totalRadius;
+}
+
+template<typename PolygonType, std::enable_if_t<IsPolygon<PolygonType>::value, int> = 0>
+inline bool testOverlap(PolygonType& polygon, Circle& circle, sf::Vector2f offset2 = {}) {
+	const auto& vertices = polygon.getWorldVertices();
+	const auto& normals = polygon.getWorldNormals();
+	const sf::Vector2f circlePos = circle.getPos() + offset2;
+	const float radiusSq = circle.getRadius() * circle.getRadius();
+
+	bool allInFront = true;
+	bool allBehind = true;
+	for (u32 i = 0; i < vertices.size(); i++) {
+		const sf::Vector2f& v1 = vertices[i];
+		const sf::Vector2f& v2 = vertices[(i + 1) % vertices.size()];
+		sf::Vector2f cp = {};
+
+		pointSegmentDistance(circlePos, v1, v2, cp);
+		if ((circlePos - cp).lengthSq() < radiusSq)
+			return true;
+
+		const float side = normals[i].dot(circlePos - v1);
+		allInFront = allInFront && side >= 0.0f;
+		allBehind = allBehind && side <= 0.0f;
+	}
+
+	// the centre is inside the polygon
+	return allInFront || allBehind;
+}
+
 struct SpatialIndexElement : AABB {
 	u32 shapeId;
 	u32 entityId;
@@ -531,6 +876,60 @@ struct Indexable {
 
 typedef spatial::RTree<float, SpatialIndexElement, 2, 4, 1, Indexable> SpatialIndexTree;
 
+/*
+ * Counters describing the work done by the physics systems during one tick.
+ * Read the last complete tick with PhysicsWorld::getStats().
+ */
+struct PhysicsStats {
+	enum Phase : u8 {
+		PHASE_INTEGRATE = 0,
+		PHASE_TREE_CLEAR,
+		PHASE_PRE_PHYSICS,
+		PHASE_MAIN_PHYSICS,
+		PHASE_POST_PHYSICS,
+		PHASE_COUNT
+	};
+
+	static constexpr std::array<const char*, PHASE_COUNT> phaseNames = {
+		"integrate", "treeClear", "prePhysics", "mainPhysics", "postPhysics"
+	};
+
+	u64 treeQueries = 0;      // broadphase queries, including the extra ones for wrap-around images
+	u64 treeCandidates = 0;   // elements returned by the broadphase, self included
+	u64 pairsMasked = 0;      // candidates rejected by the collision mask
+	u64 narrowphaseTests = 0; // testCollision() calls
+	u64 narrowphaseHits = 0;  // testCollision() calls that found a collision
+	u64 sensorTests = 0;      // testOverlap() calls
+	u64 sensorHits = 0;       // testOverlap() calls that found an overlap
+	u64 treeInserts = 0;
+	u64 treeRemoves = 0;
+	std::array<u64, PHASE_COUNT> phaseNanoseconds = {};
+
+	void reset() {
+		*this = PhysicsStats();
+	}
+
+	NODISCARD json toJson() const {
+		json phases = json::object();
+		for (u8 i = 0; i < PHASE_COUNT; i++) {
+			phases[phaseNames[i]] = phaseNanoseconds[i];
+		}
+
+		return {
+			{ "treeQueries", treeQueries },
+			{ "treeCandidates", treeCandidates },
+			{ "pairsMasked", pairsMasked },
+			{ "narrowphaseTests", narrowphaseTests },
+			{ "narrowphaseHits", narrowphaseHits },
+			{ "sensorTests", sensorTests },
+			{ "sensorHits", sensorHits },
+			{ "treeInserts", treeInserts },
+			{ "treeRemoves", treeRemoves },
+			{ "phaseNanoseconds", phases }
+		};
+	}
+};
+
 class PhysicsWorld;
 extern PhysicsWorld& getPhysicsWorld();
 
@@ -554,6 +953,13 @@ public:
 		return std::get<Polygon>(shapes[polygonId]);
 	}
 
+	template<u8 N>
+	PolygonN<N>& getPolygonN(u32 polygonId) {
+		assert(doesShapeExist(polygonId));
+		assert(std::holds_alternative<PolygonN<N>>(shapes[polygonId]));
+		return std::get<PolygonN<N>>(shapes[polygonId]);
+	}
+
 	Shape& getShape(u32 shapeId) {
 		Shape* base;
 		std::visit([&](auto&& data) {
@@ -579,6 +985,29 @@ public:
 		return id;
 	}
 
+	/* Inserts a default constructed shape of the type described by shapeEnum */
+	u32 insertShape(u32 id, ShapeEnum shapeEnum) {
+		switch (shapeEnum) {
+		case ShapeEnum::Polygon:  return insertShape<Polygon>(id);
+		case ShapeEnum::Circle:   return insertShape<Circle>(id);
+		case ShapeEnum::Polygon3: return insertShape<PolygonN<3>>(id);
+		case ShapeEnum::Polygon4: return insertShape<PolygonN<4>>(id);
+		case ShapeEnum::Polygon8: return insertShape<PolygonN<8>>(id);
+		default:
+			log(ERROR_SEVERITY_FATAL, "Invalid Shape Type\n");
+			break;
+		}
+
+		return invalidId; // silences warnings
+	}
+
+	/* Calls f with the shape as its concrete type, e.g. Circle& or PolygonN<3>& */
+	template<typename F>
+	decltype(auto) visitShape(u32 shapeId, F&& f) {
+		assert(doesShapeExist(shapeId));
+		return std::visit(std::forward<F>(f), shapes.find(shapeId)->second);
+	}
+
 	void eraseShape(u32 id) {
 		assert(doesShapeExist(id));
 
@@ -589,6 +1018,7 @@ public:
 		element.max = aabb.max;
 
 		rtree.remove(element);
+		AE_PHYSICS_STAT(stats.current.treeRemoves++);
 		shapes.erase(id);
 	}
 
@@ -605,10 +1035,219 @@ public:
 		element.max = aabb.max;
 
 		rtree.insert(element);
+		AE_PHYSICS_STAT(stats.current.treeInserts++);
+
+		if (!history.frames.empty())
+			history.pending.push_back({ element, shape.getPos(), shape.getRot() });
 	}
 
 	SpatialIndexTree& getTree() { return rtree; }
 
+	/* The counters of the last complete tick. All zero if AE_PHYSICS_STATS is 0 */
+	NODISCARD const PhysicsStats& getStats() const { return stats.last; }
+
+	/* The counters of the tick in progress, used by the physics systems */
+	NODISCARD PhysicsStats& getCurrentStats() { return stats.current; }
+
+	/* Publishes the current counters as getStats() and starts counting a new tick */
+	void endStatsTick() {
+		stats.last = stats.current;
+		stats.current.reset();
+	}
+
+	struct SensorOverlap {
+		u32 sensorShapeId;
+		u32 sensorEntityId;
+		u32 otherShapeId;
+		u32 otherEntityId;
+
+		bool operator<(const SensorOverlap& other) const {
+			return std::tie(sensorShapeId, otherShapeId) < std::tie(other.sensorShapeId, other.otherShapeId);
+		}
+
+		bool operator==(const SensorOverlap& other) const {
+			return sensorShapeId == other.sensorShapeId && otherShapeId == other.otherShapeId;
+		}
+	};
+
+	/* Called by the broadphase whenever a sensor overlaps another shape this tick */
+	void reportSensorOverlap(const SensorOverlap& overlap) {
+		sensors.current.push_back(overlap);
+	}
+
+	/*
+	 * Compares this tick's sensor overlaps to the last tick's, filling the enter and exit sets.
+	 * Called once per tick after the main physics phase.
+	 */
+	void updateSensors() {
+		std::sort(sensors.current.begin(), sensors.current.end());
+		sensors.current.erase(std::unique(sensors.current.begin(), sensors.current.end()), sensors.current.end());
+
+		sensors.enters.clear();
+		sensors.exits.clear();
+		std::set_difference(sensors.current.begin(), sensors.current.end(), sensors.last.begin(), sensors.last.end(), std::back_inserter(sensors.enters));
+		std::set_difference(sensors.last.begin(), sensors.last.end(), sensors.current.begin(), sensors.current.end(), std::back_inserter(sensors.exits));
+
+		std::swap(sensors.last, sensors.current);
+		sensors.current.clear();
+	}
+
+	/* Shapes that started overlapping a sensor this tick */
+	NODISCARD const std::vector<SensorOverlap>& getSensorEnters() const { return sensors.enters; }
+
+	/* Shapes that stopped overlapping a sensor this tick */
+	NODISCARD const std::vector<SensorOverlap>& getSensorExits() const { return sensors.exits; }
+
+	/* All shapes currently overlapping a sensor, sorted by sensor */
+	NODISCARD const std::vector<SensorOverlap>& getSensorOverlaps() const { return sensors.last; }
+
+	/*
+	 * Makes the world periodic: shapes leaving one edge of bounds come back through the opposite one,
+	 * like the arena in Asteroids. Queries and collisions work across the edges using minimum-image
+	 * offsets, so no ghost entities are needed near the borders.
+	 */
+	void setWrapBounds(const AABB& bounds) {
+		assert(bounds.max[0] > bounds.min[0] && bounds.max[1] > bounds.min[1]);
+
+		wrapping = true;
+		wrapBounds = bounds;
+	}
+
+	void clearWrapBounds() { wrapping = false; }
+
+	NODISCARD bool isWrapping() const { return wrapping; }
+	NODISCARD const AABB& getWrapBounds() const { return wrapBounds; }
+
+	NODISCARD sf::Vector2f getWrapSize() const {
+		return { wrapBounds.max[0] - wrapBounds.min[0], wrapBounds.max[1] - wrapBounds.min[1] };
+	}
+
+	/* Moves pos back inside the wrap bounds. Does nothing if the world does not wrap */
+	NODISCARD sf::Vector2f wrapPosition(sf::Vector2f pos) const {
+		if (!wrapping)
+			return pos;
+
+		const sf::Vector2f size = getWrapSize();
+		pos.x = wrapBounds.min[0] + positiveMod(pos.x - wrapBounds.min[0], size.x);
+		pos.y = wrapBounds.min[1] + positiveMod(pos.y - wrapBounds.min[1], size.y);
+		return pos;
+	}
+
+	/* Returns the offset to add to "to" so that it becomes the image of "to" closest to "from" */
+	NODISCARD sf::Vector2f getMinimumImageOffset(sf::Vector2f from, sf::Vector2f to) const {
+		if (!wrapping)
+			return { 0.0f, 0.0f };
+
+		const sf::Vector2f size = getWrapSize();
+		const sf::Vector2f delta = to - from;
+		return { -std::round(delta.x / size.x) * size.x, -std::round(delta.y / size.y) * size.y };
+	}
+
+	/*
+	 * Calls callback(SpatialIndexElement& element, sf::Vector2f offset) for every element in the tree
+	 * intersecting aabb. offset is what must be added to the element's shape to move it next to aabb,
+	 * it is only non-zero in wrap-around worlds when aabb crosses an edge.
+	 * 
+	 * Note: query() is not re-entrant, the callback must not call it again.
+	 */
+	template<typename F>
+	void query(const AABB& aabb, F&& callback) {
+		forEachImageShift(aabb, [&](sf::Vector2f shift) {
+			const AABB image = aabb.translated(shift);
+
+			queryResults.clear();
+			rtree.query(spatial::intersects<2>(image.min.data(), image.max.data()), std::back_inserter(queryResults));
+			AE_PHYSICS_STAT(stats.current.treeQueries++);
+			AE_PHYSICS_STAT(stats.current.treeCandidates += queryResults.size());
+
+			for (SpatialIndexElement& element : queryResults) {
+				callback(element, -shift);
+			}
+		});
+	}
+
+	/* A shape as it was inserted into the tree on some tick */
+	struct ShapePose : SpatialIndexElement {
+		sf::Vector2f pos;
+		float rot;
+	};
+
+	/*
+	 * Keeps the pose of every shape inserted into the tree for the last "ticks" ticks, so hits can be
+	 * validated against the world a lagging client was looking at. 0 (the default) disables the history.
+	 */
+	void setHistoryLength(u32 ticks) {
+		history.frames.assign(ticks, PoseFrame());
+		history.pending.clear();
+	}
+
+	NODISCARD u32 getHistoryLength() const { return (u32)history.frames.size(); }
+
+	NODISCARD bool isTickInHistory(u64 tick) const { return findHistoryFrame(tick) != nullptr; }
+
+	/*
+	 * Stores the poses inserted into the tree since the last call as the frame of tick,
+	 * overwriting the oldest frame. Called once per tick after the main physics phase.
+	 */
+	void commitHistory(u64 tick) {
+		if (history.frames.empty())
+			return;
+
+		// the frame we overwrite hands its storage to the next tick, so this never allocates once warm
+		PoseFrame& frame = history.frames[tick % history.frames.size()];
+		frame.tick = tick;
+		frame.valid = true;
+		std::swap(frame.poses, history.pending);
+		history.pending.clear();
+	}
+
+	/*
+	 * Calls callback(const ShapePose& pose, sf::Vector2f offset) for every shape whose AABB intersected
+	 * aabb on the given tick, offset works the same as in query(). The history is not spatially indexed,
+	 * the frame is scanned linearly. Returns false if tick is not in the history.
+	 */
+	template<typename F>
+	bool queryHistory(u64 tick, const AABB& aabb, F&& callback) const {
+		const PoseFrame* frame = findHistoryFrame(tick);
+		if (!frame)
+			return false;
+
+		forEachImageShift(aabb, [&](sf::Vector2f shift) {
+			const AABB image = aabb.translated(shift);
+
+			for (const ShapePose& pose : frame->poses) {
+				if (testCollision(pose, image))
+					callback(pose, -shift);
+			}
+		});
+
+		return true;
+	}
+
+	/*
+	 * Same as queryHistory(), but calls callback(Shape& shape, const ShapePose& pose, sf::Vector2f offset)
+	 * with the shape moved back to where it was on tick, so it can be handed to the narrowphase.
+	 * The shape is put back after the callback returns, only shapes the query visits are touched.
+	 * Shapes destroyed since tick are skipped.
+	 */
+	template<typename F>
+	bool queryRewound(u64 tick, const AABB& aabb, F&& callback) {
+		return queryHistory(tick, aabb, [&](const ShapePose& pose, sf::Vector2f offset) {
+			if (!doesShapeExist(pose.shapeId))
+				return;
+
+			Shape& shape = getShape(pose.shapeId);
+			const sf::Vector2f pos = shape.getPos();
+			const float rot = shape.getRot();
+
+			shape.setPos(pose.pos);
+			shape.setRot(pose.rot);
+			callback(shape, pose, offset);
+			shape.setPos(pos);
+			shape.setRot(rot);
+		});
+	}
+
 	void clearTree() {
 		rtree.clear();
 	}
@@ -619,10 +1258,93 @@ private:
 		polygonIndex = 1
 	};
 
+	struct PoseFrame {
+		u64 tick = 0;
+		bool valid = false;
+		std::vector<ShapePose> poses;
+	};
+
+private:
+	static float positiveMod(float value, float mod) {
+		float result = std::fmod(value, mod);
+		return result < 0.0f ? result + mod : result;
+	}
+
+	const PoseFrame* findHistoryFrame(u64 tick) const {
+		if (history.frames.empty())
+			return nullptr;
+
+		const PoseFrame& frame = history.frames[tick % history.frames.size()];
+		return frame.valid && frame.tick == tick ? &frame : nullptr;
+	}
+
+	/* Calls f(shift) for every translation of aabb that has to be queried, more than one only when aabb crosses a wrap edge */
+	template<typename F>
+	void forEachImageShift(const AABB& aabb, F&& f) const {
+		std::array<float, 3> shiftsX = { 0.0f };
+		std::array<float, 3> shiftsY = { 0.0f };
+		u32 shiftCountX = 1, shiftCountY = 1;
+
+		if (wrapping) {
+			const sf::Vector2f size = getWrapSize();
+
+			if (aabb.min[0] < wrapBounds.min[0]) shiftsX[shiftCountX++] = size.x;
+			if (aabb.max[0] > wrapBounds.max[0]) shiftsX[shiftCountX++] = -size.x;
+			if (aabb.min[1] < wrapBounds.min[1]) shiftsY[shiftCountY++] = size.y;
+			if (aabb.max[1] > wrapBounds.max[1]) shiftsY[shiftCountY++] = -size.y;
+		}
+
+		for (u32 x = 0; x < shiftCountX; x++) {
+			for (u32 y = 0; y < shiftCountY; y++) {
+				f(sf::Vector2f(shiftsX[x], shiftsY[y]));
+			}
+		}
+	}
+
 private:
 	SpatialIndexTree rtree;
-	impl::FastMap<u32, std::variant<Circle, Polygon>> shapes;
+	std::vector<SpatialIndexElement> queryResults;
+	struct {
+		PhysicsStats current;
+		PhysicsStats last;
+	} stats;
+	struct {
+		std::vector<SensorOverlap> current;
+		std::vector<SensorOverlap> last;
+		std::vector<SensorOverlap> enters;
+		std::vector<SensorOverlap> exits;
+	} sensors;
+	struct {
+		std::vector<PoseFrame> frames;
+		std::vector<ShapePose> pending;
+	} history;
+	bool wrapping = false;
+	AABB wrapBounds;
+	impl::FastMap<u32, std::variant<Circle, Polygon, PolygonN<3>, PolygonN<4>, PolygonN<8>>> shapes;
 	u32 idCounter = 0;
 };
 
+namespace impl {
+	/* Adds the time between its construction and destruction to a phase of the current PhysicsStats */
+	class PhysicsPhaseTimer {
+	public:
+#if AE_PHYSICS_STATS
+		explicit PhysicsPhaseTimer(PhysicsStats::Phase phase)
+			: phase(phase), start(std::chrono::steady_clock::now()) {}
+
+		~PhysicsPhaseTimer() {
+			auto elapsed = std::chrono::steady_clock::now() - start;
+			getPhysicsWorld().getCurrentStats().phaseNanoseconds[phase] +=
+				(u64)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+		}
+
+	private:
+		PhysicsStats::Phase phase;
+		std::chrono::steady_clock::time_point start;
+#else
+		explicit PhysicsPhaseTimer(PhysicsStats::Phase) {}
+#endif
+	};
+}
+
 AE_NAMESPACE_END
@@ -82,6 +82,11 @@ public:
         return rate;
     }
 
+    // how far into the next call we are, from 0 to 1
+    float getProgress() {
+        return std::min(callsTodo + (nowSeconds() - lastUpdate) * rate, 1.0f);
+    }
+
 private:
     Function function = nullptr;
     float rate = 0.0;
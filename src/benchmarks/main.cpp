@@ -0,0 +1,133 @@
+#include <asteroids/asteroids.hpp>
+
+using namespace ae;
+
+/*
+ * Measures how the engine encodes large snapshots, run it with:
+ *	snapshot_bench [entity count] [iterations]
+ *
+ * The world is a fixed pseudo random field of moving circles, so runs are comparable.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsedMicroseconds(Clock::time_point start) {
+	return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+static void createWorld(size_t entityCount) {
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-2000.0f, 2000.0f);
+	std::uniform_real_distribution<float> velocity(-50.0f, 50.0f);
+
+	for(size_t i = 0; i < entityCount; i++) {
+		getNetworkStateManager().entity().set([&](TransformComponent& transform, ShapeComponent& shape, IntegratableComponent& integratable) {
+			shape.shape = getPhysicsWorld().createShape<Circle>(5.0f);
+			transform.setPos(sf::Vector2f(position(random), position(random)));
+			integratable.addLinearVelocity(sf::Vector2f(velocity(random), velocity(random)));
+		});
+	}
+}
+
+// moves every entity a bit, so consecutive snapshots differ like they do in a game
+static void moveWorld() {
+	auto query = getEntityWorld().query<TransformComponent, IntegratableComponent>();
+	query.each([](TransformComponent& transform, IntegratableComponent& integratable) {
+		transform.setPos(transform.getPos() + integratable.getLinearVelocity() / 20.0f);
+	});
+	query.destruct();
+}
+
+static std::vector<u8> createFullSnapshot() {
+	MessageBuffer buffer;
+	getNetworkStateManager().createFullSnapshot(buffer);
+	return std::vector<u8>(buffer.getData(), buffer.getData() + buffer.getSize());
+}
+
+// full snapshots and deltas of a world that moved for one network update
+static void benchmarkEncoding(size_t entityCount, size_t iterations) {
+	NetworkStateManager& stateManager = getNetworkStateManager();
+
+	Clock::time_point start = Clock::now();
+	size_t fullSize = 0;
+	for(size_t i = 0; i < iterations; i++)
+		fullSize = createFullSnapshot().size();
+	const double fullTime = elapsedMicroseconds(start) / iterations;
+
+	double deltaTime = 0.0;
+	size_t deltaSize = 0;
+	for(size_t i = 0; i < iterations; i++) {
+		moveWorld();
+		const u32 baseline = stateManager.getSnapshotSequence();
+		stateManager.sealSnapshot();
+
+		MessageBuffer buffer;
+		start = Clock::now();
+		stateManager.createDeltaSnapshot(buffer, baseline);
+		deltaTime += elapsedMicroseconds(start);
+		deltaSize = buffer.getSize();
+	}
+	deltaTime /= iterations;
+
+	ae::log("full snapshot  %8zu bytes  %8.1f us  %6.1f ns per entity\n", fullSize, fullTime, 1000.0 * fullTime / entityCount);
+	ae::log("delta snapshot %8zu bytes  %8.1f us  %6.1f ns per entity\n", deltaSize, deltaTime, 1000.0 * deltaTime / entityCount);
+}
+
+static void benchmarkCompression(const std::vector<u8>& snapshot, const std::vector<std::vector<u8>>& samples, size_t iterations) {
+	MessageCodec codec;
+	std::vector<u8> compressed;
+	std::vector<u8> decompressed;
+
+	const CompressionDictionary none;
+	const CompressionDictionary trained = CompressionDictionary::train(samples);
+
+	for(const CompressionDictionary* dictionary : { &none, &trained }) {
+		const CompressionDictionary* used = dictionary->empty() ? nullptr : dictionary;
+
+		Clock::time_point start = Clock::now();
+		bool smaller = false;
+		for(size_t i = 0; i < iterations; i++)
+			smaller = codec.compress(snapshot.data(), snapshot.size(), compressed, used);
+		const double compressTime = elapsedMicroseconds(start) / iterations;
+
+		if(!smaller) {
+			ae::log("%-22s did not make the snapshot smaller\n", used ? "lz + dictionary" : "lz");
+			continue;
+		}
+
+		start = Clock::now();
+		bool valid = true;
+		for(size_t i = 0; i < iterations; i++)
+			valid &= codec.decompress(compressed.data(), compressed.size(), snapshot.size(), decompressed, used);
+		const double decompressTime = elapsedMicroseconds(start) / iterations;
+
+		valid &= decompressed == snapshot;
+		ae::log("%-22s %8zu bytes  %5.1f%%  compress %8.1f us (%6.1f MB/s)  decompress %8.1f us (%6.1f MB/s)%s\n",
+			used ? "lz + dictionary" : "lz", compressed.size(), 100.0 * compressed.size() / snapshot.size(),
+			compressTime, snapshot.size() / compressTime, decompressTime, snapshot.size() / decompressTime,
+			valid ? "" : "  ROUND TRIP FAILED");
+	}
+}
+
+int main(int argc, char* argv[]) {
+	const size_t entityCount = argc > 1 ? (size_t)std::stoul(argv[1]) : 5000;
+	const size_t iterations = argc > 2 ? (size_t)std::stoul(argv[2]) : 50;
+
+	createWorld(entityCount);
+	getNetworkStateManager().sealSnapshot();
+
+	// the dictionary is trained on earlier snapshots of the same world, like a game would ship one
+	std::vector<std::vector<u8>> samples;
+	for(size_t i = 0; i < 8; i++) {
+		moveWorld();
+		samples.push_back(createFullSnapshot());
+	}
+
+	moveWorld();
+	const std::vector<u8> snapshot = createFullSnapshot();
+	ae::log("full snapshot of %zu entities: %zu bytes, %.1f per entity\n", entityCount, snapshot.size(), (double)snapshot.size() / entityCount);
+
+	benchmarkEncoding(entityCount, iterations);
+	benchmarkCompression(snapshot, samples, iterations);
+	return 0;
+}
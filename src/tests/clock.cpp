@@ -0,0 +1,76 @@
+#include "tests.hpp"
+
+using namespace ae;
+
+static constexpr double pingRtt = 0.1;
+
+// an answer to a ping sent at time, by a server offset seconds ahead of this clock
+static void addSample(ServerClock& clock, double time, double offset, double sampleRtt = pingRtt) {
+	const double receiveTime = time + sampleRtt;
+	clock.addSample(time, receiveTime, receiveTime - sampleRtt / 2.0 + offset);
+}
+
+static double getOffset(const ServerClock& clock) {
+	return clock.getServerTime() - now<double, std::chrono::seconds::period>();
+}
+
+static bool isClose(double a, double b) {
+	return std::abs(a - b) < 1e-3;
+}
+
+// synced at offset 100 with all the fast pings answered
+static void syncClock(ServerClock& clock) {
+	for (size_t i = 0; i < ServerClock::fastPingCount; i++)
+		addSample(clock, (double)i, 100.0);
+}
+
+TEST(serverClockFollowsSamplesWhileSyncing) {
+	ServerClock clock;
+	CHECK(!clock.isSynced());
+
+	addSample(clock, 1.0, 100.0);
+	CHECK(clock.isSynced());
+	CHECK(isClose(clock.getRtt(), pingRtt));
+	CHECK(isClose(getOffset(clock), 100.0));
+
+	// the first samples are averaged evenly
+	addSample(clock, 2.0, 101.0);
+	CHECK(isClose(getOffset(clock), 100.5));
+}
+
+TEST(serverClockSlewsSmallCorrections) {
+	ServerClock clock;
+	syncClock(clock);
+	CHECK(isClose(getOffset(clock), 100.0));
+
+	// moves the target by 0.6 / 6, which is slewed towards instead of jumped to
+	addSample(clock, 10.0, 100.6);
+	CHECK(isClose(getOffset(clock), 100.0));
+
+	clock.update(20.0);
+	CHECK(isClose(getOffset(clock), 100.0));
+
+	clock.update(21.0);
+	CHECK(isClose(getOffset(clock), 100.0 + ServerClock::maxSlewRate));
+
+	// never past the target
+	clock.update(30.0);
+	CHECK(isClose(getOffset(clock), 100.1));
+}
+
+TEST(serverClockSnapsLargeCorrections) {
+	ServerClock clock;
+	syncClock(clock);
+
+	addSample(clock, 10.0, 103.0);
+	CHECK(isClose(getOffset(clock), 100.5));
+}
+
+TEST(serverClockIgnoresOutliers) {
+	ServerClock clock;
+	syncClock(clock);
+
+	addSample(clock, 10.0, 105.0, 1.0);
+	CHECK(isClose(getOffset(clock), 100.0));
+	CHECK(clock.getRtt() > pingRtt);
+}
@@ -0,0 +1,100 @@
+#include "tests.hpp"
+
+using namespace ae;
+
+// mostly a repeating pattern with a few random bytes, like snapshots of similar entities
+static std::vector<u8> createMessage(u32 seed, size_t size) {
+	std::mt19937 random(seed);
+
+	std::vector<u8> message(size);
+	for (size_t i = 0; i < size; i++)
+		message[i] = i % 16 < 12 ? (u8)(i % 16) : (u8)random();
+
+	return message;
+}
+
+TEST(codecRoundTrip) {
+	MessageCodec codec;
+	const std::vector<u8> message = createMessage(1, 4096);
+
+	std::vector<u8> compressed;
+	std::vector<u8> decompressed;
+	CHECK(codec.compress(message.data(), message.size(), compressed));
+	CHECK(compressed.size() < message.size());
+	CHECK(codec.decompress(compressed.data(), compressed.size(), message.size(), decompressed));
+	CHECK(decompressed == message);
+}
+
+TEST(codecRoundTripWithDictionary) {
+	std::vector<std::vector<u8>> samples;
+	for (u32 seed = 2; seed < 10; seed++)
+		samples.push_back(createMessage(seed, 512));
+
+	const CompressionDictionary dictionary = CompressionDictionary::train(samples);
+	CHECK(!dictionary.empty());
+	CHECK(dictionary.getHash() != 0);
+
+	MessageCodec codec;
+	const std::vector<u8> message = createMessage(10, 512);
+
+	std::vector<u8> compressed;
+	std::vector<u8> decompressed;
+	CHECK(codec.compress(message.data(), message.size(), compressed, &dictionary));
+	CHECK(codec.decompress(compressed.data(), compressed.size(), message.size(), decompressed, &dictionary));
+	CHECK(decompressed == message);
+}
+
+TEST(codecRefusesIncompressibleData) {
+	std::mt19937 random(11);
+	std::vector<u8> message(1024);
+	for (u8& byte : message)
+		byte = (u8)random();
+
+	MessageCodec codec;
+	std::vector<u8> compressed;
+	CHECK(!codec.compress(message.data(), message.size(), compressed));
+}
+
+TEST(codecRejectsMalformedInput) {
+	MessageCodec codec;
+	const std::vector<u8> message = createMessage(12, 1024);
+
+	std::vector<u8> compressed;
+	std::vector<u8> decompressed;
+	CHECK(codec.compress(message.data(), message.size(), compressed));
+
+	// the size must match exactly
+	CHECK(!codec.decompress(compressed.data(), compressed.size(), message.size() - 1, decompressed));
+	CHECK(!codec.decompress(compressed.data(), compressed.size(), message.size() + 1, decompressed));
+
+	// a truncated message can only succeed if what was cut off produced nothing
+	bool truncatedRejected = true;
+	for (size_t size = 0; size < compressed.size(); size++) {
+		if (codec.decompress(compressed.data(), size, message.size(), decompressed))
+			truncatedRejected &= decompressed == message;
+	}
+	CHECK(truncatedRejected);
+
+	// one literal, then a match reaching before the start of the output or with no offset
+	const std::vector<u8> farOffset = { 0x10, 'a', 0xFF, 0xFF };
+	const std::vector<u8> zeroOffset = { 0x10, 'a', 0x00, 0x00 };
+	CHECK(!codec.decompress(farOffset.data(), farOffset.size(), 5, decompressed));
+	CHECK(!codec.decompress(zeroOffset.data(), zeroOffset.size(), 5, decompressed));
+
+	// a length that keeps going past the end of the input
+	const std::vector<u8> endlessLength = { 0xF0, 0xFF, 0xFF };
+	CHECK(!codec.decompress(endlessLength.data(), endlessLength.size(), 1024, decompressed));
+
+	// garbage must never be read or written out of bounds, and never succeed with the wrong size
+	std::mt19937 random(13);
+	bool garbageHandled = true;
+	std::vector<u8> garbage(64);
+	for (size_t i = 0; i < 1000; i++) {
+		for (u8& byte : garbage)
+			byte = (u8)random();
+
+		if (codec.decompress(garbage.data(), garbage.size(), 256, decompressed))
+			garbageHandled &= decompressed.size() == 256;
+	}
+	CHECK(garbageHandled);
+}
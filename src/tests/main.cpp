@@ -0,0 +1,28 @@
+#include "tests.hpp"
+
+/*
+ * Runs the engine's tests, or only the ones whose names start with the first argument:
+ *	engine_tests [name prefix]
+ */
+int main(int argc, char* argv[]) {
+	const std::string prefix = argc > 1 ? argv[1] : "";
+
+	size_t run = 0;
+	size_t failed = 0;
+	for (const tests::Test& test : tests::getTests()) {
+		if (std::string(test.name).compare(0, prefix.size(), prefix) != 0)
+			continue;
+
+		const size_t failedBefore = tests::failedChecks;
+		test.run();
+		run++;
+
+		if (tests::failedChecks != failedBefore) {
+			failed++;
+			ae::log(ae::ERROR_SEVERITY_WARNING, "%s failed\n", test.name);
+		}
+	}
+
+	ae::log("%zu of %zu tests passed\n", run - failed, run);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,169 @@
+#include "tests.hpp"
+
+AE_NAMESPACE_BEGIN
+
+/* Reaches the snapshot internals of NetworkStateManager, which it is a friend of */
+struct NetworkStateManagerTest {
+	using EntityIdList = std::vector<u32>;
+	using MergedSnapshot = NetworkStateManager::MergedSnapshot;
+	using ClientView = NetworkStateManager::ClientView;
+	using SnapshotEncoder = NetworkStateManager::SnapshotEncoder;
+
+	static MergedSnapshot& merge(u32 baseline, SnapshotEncoder& encoder) {
+		return getNetworkStateManager().mergeSnapshotFrames(baseline, encoder);
+	}
+
+	static MergedSnapshot& filter(u32 baseline, const EntityIdList& known, const EntityIdList& relevant, ClientView& view, SnapshotEncoder& encoder) {
+		NetworkStateManager& manager = getNetworkStateManager();
+		return manager.filterMergedSnapshot(manager.mergeSnapshotFrames(baseline, encoder), known, EntityIdList(), relevant, view, encoder);
+	}
+
+	static u64 getComponentMask(flecs::entity entity) {
+		return getNetworkStateManager().getComponentMask(entity, ~u64(0));
+	}
+
+	static u8 getGeneration(u32 netId) {
+		return getNetworkStateManager().netIds.getGeneration(netId);
+	}
+
+	/* Writes ids like snapshots do and reads them back, bytes is what they took */
+	static EntityIdList roundTripIds(const EntityIdList& ids, size_t& bytes) {
+		MessageBuffer buffer;
+		Serializer ser = startSerialize(buffer);
+		NetworkStateManager::serializeSortedIds(ser, ids);
+		endSerialize(ser, buffer);
+		bytes = buffer.getSize();
+
+		EntityIdList read;
+		Deserializer des = startDeserialize((u32)buffer.getSize(), buffer.getData());
+		NetworkStateManager::deserializeSortedIds<u32>(des, [&](u32 id) { read.push_back(id); });
+		if (!endDeserialize(des))
+			read.clear();
+
+		return read;
+	}
+
+	/* Reads the ids of a buffer cut short, true if the reader noticed */
+	static bool failsTruncated(const EntityIdList& ids) {
+		MessageBuffer buffer;
+		Serializer ser = startSerialize(buffer);
+		NetworkStateManager::serializeSortedIds(ser, ids);
+		endSerialize(ser, buffer);
+
+		Deserializer des = startDeserialize((u32)buffer.getSize() - 1, buffer.getData());
+		NetworkStateManager::deserializeSortedIds<u32>(des, [](u32) {});
+		return !endDeserialize(des);
+	}
+};
+
+AE_NAMESPACE_END
+
+using namespace ae;
+
+using StateTest = NetworkStateManagerTest;
+
+TEST(sortedIdsRoundTrip) {
+	size_t bytes = 0;
+
+	CHECK(StateTest::roundTripIds({}, bytes).empty());
+	CHECK(bytes == 1);
+
+	// dense ids are a byte each after the count
+	StateTest::EntityIdList dense;
+	for (u32 id = 0; id < 100; id++)
+		dense.push_back(id);
+	CHECK(StateTest::roundTripIds(dense, bytes) == dense);
+	CHECK(bytes == 101);
+
+	const StateTest::EntityIdList sparse = { 1, 200, 1 << 20, 1u << 30 };
+	CHECK(StateTest::roundTripIds(sparse, bytes) == sparse);
+
+	CHECK(StateTest::failsTruncated(dense));
+	CHECK(StateTest::failsTruncated(sparse));
+}
+
+TEST(mergeResolvesChangesAgainstTheWorld) {
+	NetworkStateManager& manager = getNetworkStateManager();
+	StateTest::SnapshotEncoder encoder;
+
+	const u32 baseline = manager.sealSnapshot();
+
+	flecs::entity kept = manager.entity();
+	kept.add<TransformComponent>();
+	kept.add<IntegratableComponent>();
+	const u32 keptId = manager.getNetId(kept);
+	manager.sealSnapshot();
+
+	flecs::entity shortLived = manager.entity();
+	shortLived.add<TransformComponent>();
+	const u32 shortLivedId = manager.getNetId(shortLived);
+	manager.sealSnapshot();
+
+	// added and removed again after the baseline, only the removal is sent
+	kept.remove<IntegratableComponent>();
+	shortLived.destruct();
+	manager.sealSnapshot();
+
+	StateTest::MergedSnapshot& merged = StateTest::merge(baseline, encoder);
+
+	const u64 has = StateTest::getComponentMask(kept);
+	CHECK(merged.metaData.toAdd.find(keptId) && *merged.metaData.toAdd.find(keptId) == has);
+	CHECK(merged.metaData.toRemove.find(keptId) && (*merged.metaData.toRemove.find(keptId) & has) == 0);
+	CHECK(merged.componentData[(int)ComponentPiority::Low].toUpdate.contains(keptId));
+	CHECK(merged.metaData.spawnEntities.find(keptId) && *merged.metaData.spawnEntities.find(keptId) == StateTest::getGeneration(keptId));
+	CHECK(!merged.metaData.removeEntities.contains(keptId));
+
+	// spawned and died after the baseline, only the removal is sent
+	CHECK(merged.metaData.removeEntities.contains(shortLivedId));
+	CHECK(!merged.metaData.spawnEntities.contains(shortLivedId));
+	CHECK(!merged.metaData.toAdd.contains(shortLivedId));
+	CHECK(!merged.componentData[(int)ComponentPiority::Low].toUpdate.contains(shortLivedId));
+
+	kept.destruct();
+	manager.sealSnapshot();
+}
+
+TEST(filterRemovesEntitiesSentAfterTheBaseline) {
+	NetworkStateManager& manager = getNetworkStateManager();
+	StateTest::SnapshotEncoder encoder;
+	StateTest::ClientView view;
+
+	// the client joins with nothing, then is sent a and b but its ack does not arrive
+	const u32 baseline = manager.sealSnapshot();
+	MessageBuffer emptyBuffer;
+	manager.createClientEmptySnapshot(emptyBuffer, view);
+
+	flecs::entity a = manager.entity();
+	flecs::entity b = manager.entity();
+	const u32 aId = manager.getNetId(a);
+	const u32 bId = manager.getNetId(b);
+	manager.sealSnapshot();
+
+	StateTest::EntityIdList relevant = { aId, bId };
+	std::sort(relevant.begin(), relevant.end());
+	MessageBuffer deltaBuffer;
+	manager.createClientSnapshot(deltaBuffer, baseline, view, relevant, encoder);
+
+	// c is never sent to the client
+	b.destruct();
+	flecs::entity c = manager.entity();
+	const u32 cId = manager.getNetId(c);
+	c.destruct();
+	manager.sealSnapshot();
+
+	StateTest::MergedSnapshot& filtered = StateTest::filter(baseline, {}, { aId }, view, encoder);
+	CHECK(filtered.metaData.removeEntities.contains(bId));
+	CHECK(!filtered.metaData.removeEntities.contains(aId));
+	CHECK(!filtered.metaData.removeEntities.contains(cId));
+
+	// a is still sent whole, the client may not have it
+	CHECK(filtered.metaData.spawnEntities.find(aId) && *filtered.metaData.spawnEntities.find(aId) == StateTest::getGeneration(aId));
+
+	// leaving the view removes it like dying does
+	StateTest::MergedSnapshot& leftView = StateTest::filter(baseline, {}, {}, view, encoder);
+	CHECK(leftView.metaData.removeEntities.contains(aId));
+	CHECK(leftView.metaData.removeEntities.contains(bId));
+
+	a.destruct();
+	manager.sealSnapshot();
+}
@@ -0,0 +1,116 @@
+#include "tests.hpp"
+
+using namespace ae;
+
+TEST(entityTableIteratesInAscendingOrder) {
+	impl::EntityTable<u32> table;
+	for (u32 id : { 5000u, 3u, 1024u, 4u, 70000u })
+		table[id] = id * 2;
+
+	CHECK(table.size() == 5);
+	CHECK(table.getIds() == std::vector<u32>({ 3, 4, 1024, 5000, 70000 }));
+
+	bool valuesMatch = true;
+	table.forEach([&](u32 id, u32& value) { valuesMatch &= value == id * 2; });
+	CHECK(valuesMatch);
+
+	// ids on pages that were never allocated, or past the last one
+	CHECK(table.find(6) == nullptr);
+	CHECK(!table.contains(2048));
+	CHECK(!table.contains(1000000));
+}
+
+TEST(entityTableEraseAndClear) {
+	impl::EntityTable<int> table;
+	for (u32 id = 0; id < 10; id++)
+		table[id] = (int)id + 1;
+
+	// erasing while iterating is allowed
+	table.forEach([&](u32 id, int&) {
+		if (id % 2)
+			table.erase(id);
+	});
+
+	CHECK(table.size() == 5);
+	CHECK(table.getIds() == std::vector<u32>({ 0, 2, 4, 6, 8 }));
+	CHECK(!table.contains(3));
+
+	// an erased id starts over from a default value
+	CHECK(table[3] == 0);
+	table[3] = 7;
+	CHECK(table.getIds() == std::vector<u32>({ 0, 2, 3, 4, 6, 8 }));
+	CHECK(*table.find(3) == 7);
+
+	table.clear();
+	CHECK(table.empty());
+	CHECK(table.getIds().empty());
+	CHECK(!table.contains(0));
+
+	table[1] = 1;
+	CHECK(table.size() == 1);
+	CHECK(table.getIds() == std::vector<u32>({ 1 }));
+}
+
+TEST(netIdsAreDenseAndReusedAfterTheDelay) {
+	flecs::world& world = getEntityWorld();
+	flecs::entity a = world.entity();
+	flecs::entity b = world.entity();
+	flecs::entity c = world.entity();
+	flecs::entity d = world.entity();
+
+	impl::NetIdTable table;
+	CHECK(table.allocate(a, 0, 2) == 1);
+	CHECK(table.allocate(b, 0, 2) == 2);
+	CHECK(table.find(a) == 1);
+	CHECK(table.getEntity(2).id() == b.id());
+
+	table.release(1, 5);
+	CHECK(table.find(a) == impl::NetIdTable::invalid);
+	CHECK(!table.getEntity(1).is_valid());
+	CHECK(table.getGeneration(1) == 1);
+	CHECK(table.getGeneration(2) == 0);
+
+	// released in snapshot 5, so it is free once snapshot 7 is sealed
+	CHECK(table.allocate(c, 6, 2) == 3);
+	CHECK(table.allocate(d, 7, 2) == 1);
+	CHECK(table.getEntity(1).id() == d.id());
+	CHECK(table.getGeneration(1) == 1);
+
+	for (flecs::entity entity : { a, b, c, d })
+		entity.destruct();
+}
+
+TEST(netIdsOfDeadEntitiesResolveToNothing) {
+	flecs::world& world = getEntityWorld();
+
+	impl::NetIdTable table;
+	flecs::entity dead = world.entity();
+	table.bind(7, dead);
+	dead.destruct();
+
+	// flecs recycles the entity id with a new generation, it must not be mistaken for the dead one
+	flecs::entity recycled = world.entity();
+	CHECK(!table.getEntity(7).is_valid());
+	CHECK(table.find(recycled) == impl::NetIdTable::invalid);
+
+	recycled.destruct();
+}
+
+TEST(netIdsBoundByClients) {
+	flecs::entity entity = getEntityWorld().entity();
+
+	impl::NetIdTable table;
+	table.bind(1000, entity);
+	CHECK(table.find(entity) == 1000);
+	CHECK(table.getEntity(1000).id() == entity.id());
+	CHECK(table.getGeneration(1000) == 0);
+
+	table.setGeneration(1000, 9);
+	CHECK(table.getGeneration(1000) == 9);
+
+	table.unbind(1000);
+	CHECK(table.find(entity) == impl::NetIdTable::invalid);
+	CHECK(!table.getEntity(1000).is_valid());
+
+	entity.destruct();
+}
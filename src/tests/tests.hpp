@@ -0,0 +1,40 @@
+#pragma once
+
+#include <asteroids/asteroids.hpp>
+
+/*
+ * A minimal test runner. Every TEST() registers itself and is run by main.cpp once the engine
+ * is initialized. A failed CHECK() is logged and the test carries on.
+ */
+namespace tests {
+	struct Test {
+		const char* name;
+		void(*run)();
+	};
+
+	inline std::vector<Test>& getTests() {
+		static std::vector<Test> tests;
+		return tests;
+	}
+
+	inline size_t failedChecks = 0;
+
+	struct Registrar {
+		Registrar(const char* name, void(*run)()) {
+			getTests().push_back({ name, run });
+		}
+	};
+
+	inline void fail(const char* file, int line, const char* condition) {
+		failedChecks++;
+		ae::log(ae::ERROR_SEVERITY_WARNING, "%s:%i: CHECK(%s) failed\n", file, line, condition);
+	}
+}
+
+#define TEST(name) \
+	static void name(); \
+	static tests::Registrar name##Registrar(#name, name); \
+	static void name()
+
+#define CHECK(condition) \
+	do { if (!(condition)) tests::fail(__FILE__, __LINE__, #condition); } while (0)
@@ -0,0 +1,87 @@
+#include "tests.hpp"
+
+using namespace ae;
+
+TEST(spscQueueKeepsOrder) {
+	impl::SpscQueue<int> queue(3); // rounded up to 4
+
+	for (int i = 0; i < 4; i++)
+		CHECK(queue.push(i));
+	CHECK(!queue.push(4));
+
+	int value = -1;
+	for (int i = 0; i < 4; i++)
+		CHECK(queue.pop(value) && value == i);
+	CHECK(!queue.pop(value));
+
+	// the positions wrap around the ring
+	for (int i = 0; i < 10; i++) {
+		CHECK(queue.push(i));
+		CHECK(queue.pop(value) && value == i);
+	}
+}
+
+TEST(spscQueueAcrossThreads) {
+	constexpr u32 count = 100000;
+	impl::SpscQueue<u32> queue(64);
+
+	std::thread producer([&]() {
+		for (u32 i = 0; i < count; i++) {
+			while (!queue.push(i))
+				std::this_thread::yield();
+		}
+	});
+
+	bool ordered = true;
+	for (u32 expected = 0; expected < count;) {
+		u32 value;
+		if (!queue.pop(value)) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		ordered &= value == expected;
+		expected++;
+	}
+
+	producer.join();
+	CHECK(ordered);
+}
+
+TEST(workerPoolRunsEveryIndexOnce) {
+	impl::WorkerPool pool;
+	pool.setThreadCount(3);
+	CHECK(pool.getThreadCount() == 3);
+
+	const size_t counts[] = { 0, 1, 2, 1000 };
+	for (size_t count : counts) {
+		std::vector<std::atomic<u32>> calls(count);
+		std::atomic<bool> badWorker{ false };
+
+		pool.parallelFor(count, [&](size_t index, size_t worker) {
+			calls[index]++;
+			if (worker > 3)
+				badWorker = true;
+		});
+
+		bool once = true;
+		for (const std::atomic<u32>& called : calls)
+			once &= called == 1;
+
+		CHECK(once);
+		CHECK(!badWorker);
+	}
+
+	// without threads everything runs on the caller
+	pool.setThreadCount(0);
+
+	size_t sum = 0;
+	bool onCaller = true;
+	pool.parallelFor(10, [&](size_t index, size_t worker) {
+		sum += index;
+		onCaller &= worker == 0;
+	});
+
+	CHECK(sum == 45);
+	CHECK(onCaller);
+}